@@ -35,10 +35,71 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <string>
 #include <vector>
 #include <map>
+#include <set>
 #include <algorithm>
 #include <exception>
 #include <stdexcept>
 #include <fstream>
+#include <iterator>
+#include <cstddef>
+#include <cstring>
+#include <new>
+
+#if (__cplusplus >= 201103L) || (defined(_MSC_VER) && (_MSC_VER >= 1900))
+
+#define FS_CPP11_
+
+// Marks member functions that have a separate rvalue (&&) overload.
+#define FS_LVALUE_REF_ &
+
+#include <deque>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <unordered_map>
+#if defined(__has_include)
+#if __has_include(<version>)
+#include <version>
+#endif
+#endif
+#ifdef __cpp_lib_string_view
+#define FS_STRING_VIEW_
+#include <string_view>
+#endif
+#ifdef __cpp_lib_span
+#define FS_SPAN_
+#include <span>
+#endif
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#define FS_COROUTINES_
+#include <coroutine>
+#endif
+#endif
+
+#else
+
+#define FS_LVALUE_REF_
+
+#endif
+
+#if defined(__AVX2__)
+#define FS_AVX2_
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define FS_SSE2_
+#include <emmintrin.h>
+#ifdef FS_AVX2_
+#include <immintrin.h>
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
 
 #if defined(_WIN32) || defined(_WIN64)
 
@@ -56,6 +117,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <windows.h>
 #include <winioctl.h>
 #include <direct.h>
+#include <malloc.h>
 #include <ctype.h>
 
 extern "C" {
@@ -83,13 +145,46 @@ struct TMN_REPARSE_DATA_BUFFER
 
 #define FS_POSIX_
 
+#if defined(__linux__)
+#define FS_LINUX_
+#endif
+
 #include <dirent.h>
 #include <sys/stat.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
 #include <stdio.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <limits.h>
+#include <poll.h>
+
+#ifdef FS_LINUX_
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/eventfd.h>
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+#if defined(SYS_statx) && defined(STATX_BASIC_STATS)
+#define FS_STATX_
+#endif
+// io_uring is driven through the raw system calls; only the kernel header is
+// needed.  Headers from 5.17 on define every operation used here.
+#if defined(FS_STATX_) && defined(__NR_io_uring_setup) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#ifdef IORING_FEAT_CQE_SKIP
+#define FS_IO_URING_
+#endif
+#endif
+#endif
+#endif
 
 #endif
 
@@ -357,1903 +452,8783 @@ void to_wide_string(const std::vector<std::string>& in, std::vector<std::wstring
 		out.push_back(temp);
 	}
 }
+
+// The string type used by the operating system's directory API.
+#ifdef FS_WINDOWS_
+typedef std::wstring native_string_t;
+#endif //#ifdef FS_WINDOWS_
+#ifdef FS_POSIX_
+typedef std::string native_string_t;
+#endif //#ifdef FS_POSIX_
+
+inline void convert_string(const std::string& in, std::string& out)
+{
+	out = in;
+}
+
+inline void convert_string(const std::wstring& in, std::wstring& out)
+{
+	out = in;
+}
+
+inline void convert_string(const std::wstring& in, std::string& out)
+{
+	to_narrow_string(in, out);
+}
+
+inline void convert_string(const std::string& in, std::wstring& out)
+{
+	to_wide_string(in, out);
+}
 } //namespace internal
 #endif // REGION: narrow/wide string conversion
 
-#if 1 // REGION: POSIX Glob
+#if 1 // REGION: find_literal
 namespace internal
 {
-#ifdef FS_POSIX_
-//template<class T>
-//bool glob_match(std::basic_string<T>::const_iterator i_begin, std::basic_string<T>::const_iterator i_end,
-//				std::basic_string<T>::const_iterator p_begin, std::basic_string<T>::const_iterator p_end)
+#ifdef FS_SSE2_
+inline unsigned int lowest_bit_index(unsigned int mask)
+{
+	#if defined(_MSC_VER)
+		unsigned long index;
+		_BitScanForward(&index, mask);
+		return index;
+	#else
+		return __builtin_ctz(mask);
+	#endif
+}
+#endif //#ifdef FS_SSE2_
+
+// Finds the first occurrence of needle in [first, last).  Returns 0 if there is
+// none.
 template<class T>
-bool glob_match(T i_begin, T i_end,
-				T p_begin, T p_end)
+const T* find_literal(const T* first, const T* last, const T* needle, size_t needle_length)
+{
+	const T* found = std::search(first, last, needle, needle + needle_length);
+	return ((found == last) && (needle_length != 0)) ? 0 : found;
+}
+
+// For narrow strings, candidate positions are found by comparing a block of
+// positions at once against the needle's first and last characters, and only
+// those candidates are compared in full.
+template<>
+inline const char* find_literal(const char* first, const char* last, const char* needle, size_t needle_length)
 {
-	if (i_begin == i_end)
+	const size_t length = static_cast<size_t>(last - first);
+	if (needle_length == 0)
+	{
+		return first;
+	}
+	if (needle_length > length)
 	{
-		return (p_begin == p_end);
+		return 0;
 	}
-	while ((i_begin != i_end) && (p_begin != p_end))
+
+	size_t pos = 0;
+
+	#ifdef FS_AVX2_
 	{
-		switch (*p_begin)
+		const __m256i first_char	= _mm256_set1_epi8(needle[0]);
+		const __m256i last_char		= _mm256_set1_epi8(needle[needle_length-1]);
+		for (; pos + needle_length - 1 + 32 <= length; pos += 32)
 		{
-			case '*':
-			{
-				return 
-					glob_match(i_begin+1, i_end, p_begin, p_end)
-					||
-					glob_match(i_begin, i_end, p_begin+1, p_end) // needed since '*' can be non-consuming
-					||
-					glob_match(i_begin+1, i_end, p_begin+1, p_end);
-			}
-			case '\\':
+			const __m256i block_first	= _mm256_loadu_si256(reinterpret_cast<const __m256i*>(first + pos));
+			const __m256i block_last	= _mm256_loadu_si256(reinterpret_cast<const __m256i*>(first + pos + needle_length - 1));
+			unsigned int mask = static_cast<unsigned int>(_mm256_movemask_epi8(
+									_mm256_and_si256(_mm256_cmpeq_epi8(first_char, block_first),
+													 _mm256_cmpeq_epi8(last_char, block_last))));
+			while (mask != 0)
 			{
-				++p_begin;
-				if (p_begin == p_end)
+				const size_t candidate = pos + lowest_bit_index(mask);
+				if ((needle_length < 3) || (memcmp(first + candidate + 1, needle + 1, needle_length - 2) == 0))
 				{
-					return false;
+					return first + candidate;
 				}
-				// fall through
+				mask &= mask - 1;
 			}
-			default:
+		}
+	}
+	#endif //#ifdef FS_AVX2_
+
+	#ifdef FS_SSE2_
+	{
+		const __m128i first_char	= _mm_set1_epi8(needle[0]);
+		const __m128i last_char		= _mm_set1_epi8(needle[needle_length-1]);
+		for (; pos + needle_length - 1 + 16 <= length; pos += 16)
+		{
+			const __m128i block_first	= _mm_loadu_si128(reinterpret_cast<const __m128i*>(first + pos));
+			const __m128i block_last	= _mm_loadu_si128(reinterpret_cast<const __m128i*>(first + pos + needle_length - 1));
+			unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(
+									_mm_and_si128(_mm_cmpeq_epi8(first_char, block_first),
+												  _mm_cmpeq_epi8(last_char, block_last))));
+			while (mask != 0)
 			{
-				if (*p_begin != *i_begin)
+				const size_t candidate = pos + lowest_bit_index(mask);
+				if ((needle_length < 3) || (memcmp(first + candidate + 1, needle + 1, needle_length - 2) == 0))
 				{
-					return false;
+					return first + candidate;
 				}
-				// fall through
-			}
-			case '?':
-			{
-				++i_begin;
-				++p_begin;
-				break;
+				mask &= mask - 1;
 			}
 		}
 	}
-	return (i_begin == i_end);
-}
+	#endif //#ifdef FS_SSE2_
 
-template<class T>
-bool glob_match(const std::basic_string<T>& in, const std::basic_string<T>& pattern)
-{
-	return glob_match(in.begin(), in.end(), pattern.begin(), pattern.end());
+	for (; pos + needle_length <= length; ++pos)
+	{
+		if ((first[pos] == needle[0]) && (memcmp(first + pos, needle, needle_length) == 0))
+		{
+			return first + pos;
+		}
+	}
+	return 0;
 }
-#endif //#ifdef FS_POSIX_
 } //namespace internal
-#endif // REGION: POSIX Glob
+#endif // REGION: find_literal
 
-#if 1 // REGION: Win32 Utility Functions
+#if 1 // REGION: compiled glob
 namespace internal
 {
+// Globs follow the platform's file name case rules unless told otherwise.
 #ifdef FS_WINDOWS_
-template<class T>
-void to_win32_path(T& path_str);
+const bool glob_case_insensitive = true;
+#endif //#ifdef FS_WINDOWS_
+#ifdef FS_POSIX_
+const bool glob_case_insensitive = false;
+#endif //#ifdef FS_POSIX_
+} //namespace internal
 
-template<>
-void to_win32_path(std::string& path_str)
+// A glob pattern compiled once into a token list that can then be matched
+// against many names.  Supported syntax:
+//	*		any sequence of characters, including none
+//	?		any single character
+//	[a-z]	any character in the set; '!' or '^' after '[' negates the set
+//	\c		the character c, literally
+// Matching never recurses: a '*' only remembers the position to resume from, so
+// a name is matched in at most O(name length * pattern length) steps.  Case-
+// insensitive matching folds ASCII letters only, and is the default on Windows.
+template<class T>
+class basic_compiled_glob
 {
-	std::string::iterator it	= path_str.begin();
-	std::string::iterator itEnd	= path_str.end();
-	for (; it!=itEnd; ++it)
-	{
-		if (*it == '/')
-		{
-			*it = '\\';
-		}
-	}
-}
+public:
+	typedef T						char_t;
+	typedef std::basic_string<T>	string_t;
 
-template<>
-void to_win32_path(std::wstring& path_str)
-{
-	std::wstring::iterator it		= path_str.begin();
-	std::wstring::iterator itEnd	= path_str.end();
-	for (; it!=itEnd; ++it)
+private:
+	struct Token
 	{
-		if (*it == '/')
+		enum Enum
 		{
-			*it = '\\';
-		}
-	}
-}
-
-template<class T>
-void remove_extended_fs_indicator(T& path_str);
+			Literal,
+			AnyChar,
+			AnySequence,
+			Set,
+		};
+	};
 
-template<>
-void remove_extended_fs_indicator(std::string& path_str)
-{
-	std::string extended_fs_indicator("\\\\?\\");
-	if (path_str.find(extended_fs_indicator) == 0)
+	struct token
 	{
-		path_str.erase(0, extended_fs_indicator.size());
-	}
-}
+		typename Token::Enum	kind;
+		T						ch;		// Literal
+		size_t					set;	// Set: index into sets
+	};
 
-template<>
-void remove_extended_fs_indicator(std::wstring& path_str)
-{
-	std::wstring extended_fs_indicator(L"\\\\?\\");
-	if (path_str.find(extended_fs_indicator) == 0)
+	struct char_set
 	{
-		path_str.erase(0, extended_fs_indicator.size());
-	}
-}
+		std::vector<std::pair<T, T> >	ranges;
+		bool							negated;
+	};
 
-template<class T>
-void prepend_extended_fs_indicator(T& path_str);
+	std::vector<token>		tokens;
+	std::vector<char_set>	sets;
+	string_t				source;
+	bool					case_insensitive;
 
-template<>
-void prepend_extended_fs_indicator(std::wstring& path_str)
-{
-	// Prevent expansion if path contains "$" (indicating environment variable replacement)
-	if (path_str.find('$') != std::wstring::npos)
+	// Literal parts every match must contain, used to reject most names
+	// before running the matcher.
+	string_t				prefix;
+	string_t				suffix;
+	string_t				required;	// longest literal run between two '*'
+	size_t					min_length;
+	bool					has_star;
+
+	static T to_lower(T c)
 	{
-		std::string npath;
-		to_narrow_string(path_str, npath);
-		throw filesystem_error("Path strings with environment variable indicators ('$') cannot be used in this context.", __FILE__, __LINE__, npath, "");
+		return ((c >= 'A') && (c <= 'Z')) ? static_cast<T>(c - 'A' + 'a') : c;
 	}
 
-	// Don't bother if a path is less than (MAX_PATH-12) characters.
-	// MAX_PATH - 12 is needed when creating directories (due to the mandatory 8.3 minimum filename requirements).
-	// Source: http://msdn.microsoft.com/en-us/library/aa365247(VS.85).aspx#maxpath
-	if (path_str.size() < (MAX_PATH - 12))
+	static T to_upper(T c)
 	{
-		return;	// if the path is empty, we'll return here...
+		return ((c >= 'a') && (c <= 'z')) ? static_cast<T>(c - 'a' + 'A') : c;
 	}
 
-	// Prevent expansion if path contains "." or ".." elements.
-	// The extended indicator "\\?\" prevents expansion of "." and ".." path elements.
-	// Source: http://msdn.microsoft.com/en-us/library/aa365247(VS.85).aspx#maxpath
-	//
-	//	We don't have to worry about the path being exactly ".." or "." since these path
-	//	strings are too short and the function will return inside the previous if block.
-	//	We need to test for the following:
-	//	* occurrances of "\..\"
-	//	* occurrances of "\.\"
-	//	* occurrances of "..\" at the beginning of the path string
-	//	* occurrances of ".\" at the beginning of the path string
-	//	* occurrances of "\.." at the end of the path string
-	//	* occurrances of "\." at the end of the path string
-	if ((path_str.find(L"\\..\\") != std::wstring::npos) ||
-		(path_str.find(L"\\.\\") != std::wstring::npos) ||
-		(path_str.find(L"..\\") == 0) ||
-		(path_str.find(L".\\") == 0) ||
-		(path_str.find(L"\\..", path_str.size()-3) != std::wstring::npos) ||
-		(path_str.find(L"\\.", path_str.size()-2) != std::wstring::npos))
+	void add_token(typename Token::Enum kind, T ch = 0, size_t set = 0)
 	{
-		std::string npath;
-		to_narrow_string(path_str, npath);
-		throw filesystem_error("Path is too long to contain \".\" or \"..\".  Windows cannot properly expand the path string.", __FILE__, __LINE__, npath, "");
+		token t;
+		t.kind	= kind;
+		t.ch	= ch;
+		t.set	= set;
+		tokens.push_back(t);
 	}
 
-	std::wstring extended_fs_indicator(L"\\\\?\\");
-	std::wstring extended_unc_indicator(L"\\\\?\\UNC");
-	if (path_str.find(extended_fs_indicator) != 0) // will also match the UNC extended filesystem indicator
+	// Parses a set starting just after '['.  Returns the index just past the
+	// closing ']', or 0 if the set isn't terminated.
+	size_t compile_set(size_t pos)
 	{
-		if (path_str.find(L"\\\\") == 0) // "\\" found at the beginning of the string -- indicative of a UNC path
+		const size_t	length = source.size();
+		char_set		cs;
+
+		cs.negated = (pos < length) && ((source[pos] == '!') || (source[pos] == '^'));
+		if (cs.negated)
 		{
-			// "\\server\share" should become "\\?\UNC\server\share".
-			// Source: http://msdn.microsoft.com/en-us/library/aa365247(VS.85).aspx#maxpath
-			path_str.swap(extended_unc_indicator.append(path_str.begin()+1, path_str.end()));
+			++pos;
 		}
-		else
+
+		bool first = true;
+		while (pos < length)
 		{
-			path_str.swap(extended_fs_indicator.append(path_str));
+			T low = source[pos];
+			if ((low == ']') && !first)
+			{
+				sets.push_back(cs);
+				add_token(Token::Set, 0, sets.size()-1);
+				return pos+1;
+			}
+			first = false;
+			if ((low == '\\') && (pos+1 < length))
+			{
+				low = source[++pos];
+			}
+			++pos;
+
+			T high = low;
+			if ((pos+1 < length) && (source[pos] == '-') && (source[pos+1] != ']'))
+			{
+				high = source[pos+1];
+				pos += 2;
+				if ((high == '\\') && (pos < length))
+				{
+					high = source[pos++];
+				}
+			}
+			cs.ranges.push_back(std::make_pair(low, high));
 		}
+		return 0;
 	}
-}
 
-template<class T>
-T cur_drive_path(const T& in);
-
-template<>
-std::wstring cur_drive_path(const std::wstring& in)
-{
-	std::wstring cpath;
-	int	drive, curdrive;
-
-	// Save current drive.
-	curdrive = _getdrive();
-
-	if ((in[0] >= 'A') && (in[0] <= 'Z'))
-	{
-		drive = 1 + (in[0] - 'A');
-	}
-	else if ((in[0] >= 'a') && (in[0] <= 'z'))
-	{
-		drive = 1 + (in[0] - 'a');
-	}
-	else
+	void compile()
 	{
-		std::string nin;
-		to_narrow_string(in, nin);
-		GENERARE_FILESYSTEM_ERROR1(nin);
+		const size_t length = source.size();
+		for (size_t pos=0; pos<length; )
+		{
+			T c = source[pos];
+			switch (c)
+			{
+				case '*':
+				{
+					if (tokens.empty() || (tokens.back().kind != Token::AnySequence))
+					{
+						add_token(Token::AnySequence);
+					}
+					++pos;
+					break;
+				}
+				case '?':
+				{
+					add_token(Token::AnyChar);
+					++pos;
+					break;
+				}
+				case '[':
+				{
+					size_t next = compile_set(pos+1);
+					if (next != 0)
+					{
+						pos = next;
+						break;
+					}
+					add_token(Token::Literal, c); // unterminated set: match '[' literally
+					++pos;
+					break;
+				}
+				case '\\':
+				{
+					if (pos+1 == length)
+					{
+						throw filesystem_error("Glob pattern ends with an escape character", __FILE__, __LINE__, "", "");
+					}
+					c = source[pos+1];
+					add_token(Token::Literal, case_insensitive ? to_lower(c) : c);
+					pos += 2;
+					break;
+				}
+				default:
+				{
+					add_token(Token::Literal, case_insensitive ? to_lower(c) : c);
+					++pos;
+					break;
+				}
+			}
+		}
 	}
 
-	if(!_chdrive(drive))
+	void compile_prefilter()
 	{
-		wchar_t* buffer = _wgetdcwd(drive, 0, 0);
+		const size_t token_count = tokens.size();
 
-		if (buffer == NULL)
+		min_length	= 0;
+		has_star	= false;
+		for (size_t t=0; t<token_count; ++t)
 		{
-			std::string nin;
-			to_narrow_string(in, nin);
-			GENERARE_FILESYSTEM_ERROR1(nin);
+			if (tokens[t].kind == Token::AnySequence)
+			{
+				has_star = true;
+			}
+			else
+			{
+				++min_length;
+			}
 		}
-		cpath = buffer;
-		free(buffer);
-	}
-	else
+
+		size_t t = 0;
+		for (; (t < token_count) && (tokens[t].kind == Token::Literal); ++t)
+		{
+			prefix.push_back(tokens[t].ch);
+		}
+		const size_t prefix_end = t;
+
+		t = token_count;
+		for (; (t > prefix_end) && (tokens[t-1].kind == Token::Literal); --t)
+		{
+			suffix.insert(suffix.begin(), tokens[t-1].ch);
+		}
+		const size_t suffix_begin = t;
+
+		if (!has_star)
+		{
+			return; // the name length is fixed; prefix and suffix say enough
+		}
+
+		string_t run;
+		for (t=prefix_end; t<suffix_begin; ++t)
+		{
+			if (tokens[t].kind == Token::Literal)
+			{
+				run.push_back(tokens[t].ch);
+			}
+			else
+			{
+				if (run.size() > required.size())
+				{
+					required.swap(run);
+				}
+				run.clear();
+			}
+		}
+		if (run.size() > required.size())
+		{
+			required.swap(run);
+		}
+	}
+
+	bool prefilter(const char_t* begin, const char_t* end) const
 	{
-		std::string nin;
-		to_narrow_string(in, nin);
-		GENERARE_FILESYSTEM_ERROR1(nin);
+		const size_t length = static_cast<size_t>(end - begin);
+		if ((length < min_length) || (!has_star && (length != min_length)))
+		{
+			return false;
+		}
+		if (case_insensitive)
+		{
+			return true; // literals are folded; leave it to the matcher
+		}
+		if (!prefix.empty() && !std::equal(prefix.begin(), prefix.end(), begin))
+		{
+			return false;
+		}
+		if (!suffix.empty() && !std::equal(suffix.begin(), suffix.end(), end - suffix.size()))
+		{
+			return false;
+		}
+		if (!required.empty() &&
+			(internal::find_literal(begin + prefix.size(), end - suffix.size(), required.data(), required.size()) == 0))
+		{
+			return false;
+		}
+		return true;
 	}
 
-	_chdrive( curdrive ); // Restore original drive.
+	bool in_set(const char_set& cs, T c) const
+	{
+		bool found = false;
+		for (size_t i=0; !found && (i<cs.ranges.size()); ++i)
+		{
+			found = (c >= cs.ranges[i].first) && (c <= cs.ranges[i].second);
+			if (!found && case_insensitive)
+			{
+				T lower = to_lower(c);
+				T upper = to_upper(c);
+				found = ((lower >= cs.ranges[i].first) && (lower <= cs.ranges[i].second)) ||
+						((upper >= cs.ranges[i].first) && (upper <= cs.ranges[i].second));
+			}
+		}
+		return (found != cs.negated);
+	}
 
-	return cpath;
-}
+	bool match_one(const token& t, T c) const
+	{
+		switch (t.kind)
+		{
+			case Token::Literal:	return (t.ch == (case_insensitive ? to_lower(c) : c));
+			case Token::AnyChar:	return true;
+			case Token::Set:		return in_set(sets[t.set], c);
+			default:				return false;
+		}
+	}
 
-template<>
-std::string cur_drive_path(const std::string& in)
-{
-	std::string		result;
-	std::wstring	wresult = cur_drive_path(std::wstring(1, in[0]));
-	to_narrow_string(wresult, result);
-	return result;
-}
-#endif //#ifdef FS_WINDOWS_
-} //namespace internal
-#endif // REGION: Win32 Utility Functions
+public:
+	basic_compiled_glob()
+		: case_insensitive(internal::glob_case_insensitive)
+		, min_length(0)
+		, has_star(false)
+	{
+	}
 
-#if 1 // REGION: compare_path_element
-namespace internal
-{
-#ifdef FS_WINDOWS_
-template<class T>
-bool compare_path_element(T e1, T e2);
+	basic_compiled_glob(const string_t& pattern, bool case_insensitive_ = internal::glob_case_insensitive)
+		: source(pattern)
+		, case_insensitive(case_insensitive_)
+	{
+		compile();
+		compile_prefilter();
+	}
 
-template<>
-bool compare_path_element(std::string e1, std::string e2)
+	basic_compiled_glob(const char_t* pattern, bool case_insensitive_ = internal::glob_case_insensitive)
+		: source(pattern)
+		, case_insensitive(case_insensitive_)
+	{
+		compile();
+		compile_prefilter();
+	}
+
+	// An empty pattern; directory scans treat it as "no filtering".
+	bool empty() const
+	{
+		return source.empty();
+	}
+
+	const string_t& pattern() const
+	{
+		return source;
+	}
+
+	bool is_case_insensitive() const
+	{
+		return case_insensitive;
+	}
+
+	bool match(const char_t* begin, const char_t* end) const
+	{
+		const size_t	token_count	= tokens.size();
+		size_t			t			= 0;
+		const char_t*	in			= begin;
+		bool			star_seen	= false;
+		size_t			star_t		= 0;	// token after the last '*' seen
+		const char_t*	star_in		= 0;	// input position that '*' resumes from
+
+		if (!prefilter(begin, end))
+		{
+			return false;
+		}
+
+		while (in != end)
+		{
+			if ((t < token_count) && (tokens[t].kind == Token::AnySequence))
+			{
+				star_seen	= true;
+				star_t		= ++t;
+				star_in		= in;
+			}
+			else if ((t < token_count) && match_one(tokens[t], *in))
+			{
+				++t;
+				++in;
+			}
+			else if (star_seen)
+			{
+				// let the last '*' absorb one more character and retry
+				t	= star_t;
+				in	= ++star_in;
+			}
+			else
+			{
+				return false;
+			}
+		}
+		while ((t < token_count) && (tokens[t].kind == Token::AnySequence))
+		{
+			++t;
+		}
+		return (t == token_count);
+	}
+
+	bool match(const string_t& name) const
+	{
+		const char_t* begin = name.c_str();
+		return match(begin, begin + name.size());
+	}
+};
+
+typedef basic_compiled_glob<char>		compiled_glob;
+typedef basic_compiled_glob<wchar_t>	wcompiled_glob;
+
+// A set of up to 64 glob patterns matched against a name in one call.  The
+// result is a bit mask with bit i set when pattern i matched.  Patterns of the
+// common "*.ext" form are looked up by the name's extension in a single table
+// instead of being matched one at a time.
+template<class T>
+class basic_glob_set
 {
-	std::string::iterator it	= e1.begin();
-	std::string::iterator itEnd	= e1.end();
-	for (; it!=itEnd; ++it)
+public:
+	typedef T						char_t;
+	typedef std::basic_string<T>	string_t;
+	typedef unsigned long long		mask_t;
+
+	enum
 	{
-		if (__isascii(*it) && isupper(*it))
+		max_patterns = 64,
+	};
+
+private:
+	typedef std::map<string_t, mask_t> extension_map_t;
+
+	typedef std::vector<std::pair<basic_compiled_glob<T>, mask_t> > glob_list_t;
+
+	std::vector<string_t>	patterns;
+	glob_list_t				globs;		// patterns that aren't "*.ext"
+	extension_map_t			extensions;
+	bool					case_insensitive;
+
+	static T to_lower(T c)
+	{
+		return ((c >= 'A') && (c <= 'Z')) ? static_cast<T>(c - 'A' + 'a') : c;
+	}
+
+	// Returns true and the extension if pattern is "*." followed only by
+	// ordinary characters other than '.'.
+	static bool is_extension_pattern(const string_t& pattern, string_t& extension)
+	{
+		if ((pattern.size() < 2) || (pattern[0] != '*') || (pattern[1] != '.'))
 		{
-			*it = _tolower(*it);
+			return false;
+		}
+		for (size_t pos=2; pos<pattern.size(); ++pos)
+		{
+			T c = pattern[pos];
+			if ((c == '*') || (c == '?') || (c == '[') || (c == '\\') || (c == '.'))
+			{
+				return false;
+			}
 		}
+		extension = pattern.substr(2);
+		return true;
 	}
-	it		= e2.begin();
-	itEnd	= e2.end();
-	for (; it!=itEnd; ++it)
+
+public:
+	explicit basic_glob_set(bool case_insensitive_ = internal::glob_case_insensitive)
+		: case_insensitive(case_insensitive_)
 	{
-		if (__isascii(*it) && isupper(*it))
+	}
+
+	// Adds a pattern and returns its index (its bit in the match mask).
+	size_t add(const string_t& pattern)
+	{
+		if (patterns.size() == max_patterns)
 		{
-			*it = _tolower(*it);
+			throw filesystem_error("Too many patterns in glob set", __FILE__, __LINE__, "", "");
+		}
+		const size_t	index	= patterns.size();
+		const mask_t	bit		= static_cast<mask_t>(1) << index;
+
+		string_t extension;
+		if (is_extension_pattern(pattern, extension))
+		{
+			if (case_insensitive)
+			{
+				std::transform(extension.begin(), extension.end(), extension.begin(), &basic_glob_set::to_lower);
+			}
+			extensions[extension] |= bit;
+		}
+		else
+		{
+			globs.push_back(std::make_pair(basic_compiled_glob<T>(pattern, case_insensitive), bit));
 		}
+		patterns.push_back(pattern);
+		return index;
 	}
 
-	return (e1 == e2);
-}
+	size_t size() const
+	{
+		return patterns.size();
+	}
 
-template<>
-bool compare_path_element(std::wstring e1, std::wstring e2)
-{
-	std::wstring::iterator it		= e1.begin();
-	std::wstring::iterator itEnd	= e1.end();
-	for (; it!=itEnd; ++it)
+	bool empty() const
 	{
-		*it = _tolower(*it);
+		return patterns.empty();
 	}
-	it		= e2.begin();
-	itEnd	= e2.end();
-	for (; it!=itEnd; ++it)
+
+	bool is_case_insensitive() const
 	{
-		*it = towlower(*it);
+		return case_insensitive;
 	}
 
-	return (e1 == e2);
+	const string_t& pattern(size_t index) const
+	{
+		return patterns[index];
+	}
+
+	mask_t match(const char_t* begin, const char_t* end) const
+	{
+		mask_t result = 0;
+
+		if (!extensions.empty())
+		{
+			const char_t* dot = end;
+			while ((dot != begin) && (*(dot-1) != '.'))
+			{
+				--dot;
+			}
+			if (dot != begin)
+			{
+				string_t extension(dot, end);
+				if (case_insensitive)
+				{
+					std::transform(extension.begin(), extension.end(), extension.begin(), &basic_glob_set::to_lower);
+				}
+				typename extension_map_t::const_iterator it = extensions.find(extension);
+				if (it != extensions.end())
+				{
+					result |= it->second;
+				}
+			}
+		}
+
+		for (size_t i=0; i<globs.size(); ++i)
+		{
+			if (globs[i].first.match(begin, end))
+			{
+				result |= globs[i].second;
+			}
+		}
+		return result;
+	}
+
+	mask_t match(const string_t& name) const
+	{
+		const char_t* begin = name.c_str();
+		return match(begin, begin + name.size());
+	}
+};
+
+typedef basic_glob_set<char>	glob_set;
+typedef basic_glob_set<wchar_t>	wglob_set;
+
+namespace internal
+{
+template<class T>
+bool glob_match(const std::basic_string<T>& in, const std::basic_string<T>& pattern)
+{
+	return basic_compiled_glob<T>(pattern).match(in);
 }
-#endif //#ifdef FS_WINDOWS_
-#ifdef FS_POSIX_
+
+// The pattern type understood by directory_scanner: a compiled glob over
+// native names.  Plain string patterns follow the platform's file name case
+// rules, so on Windows they match case-insensitively as FindFirstFile did.
+typedef basic_compiled_glob<native_string_t::value_type> native_pattern_t;
+
 template<class T>
-bool compare_path_element(T e1, T e2)
+native_pattern_t to_native_pattern(const std::basic_string<T>& pattern)
 {
-	return (e1 == e2);
+	native_string_t npattern;
+	convert_string(pattern, npattern);
+	return native_pattern_t(npattern);
+}
+
+template<class T>
+native_pattern_t to_native_pattern(const basic_compiled_glob<T>& pattern)
+{
+	native_string_t npattern;
+	convert_string(pattern.pattern(), npattern);
+	return native_pattern_t(npattern, pattern.is_case_insensitive());
 }
-#endif //#ifdef FS_POSIX_
 } //namespace internal
-#endif // REGION: compare_path_element
+#endif // REGION: compiled glob
 
-#if 1 // REGION: current_working_dir
+#if 1 // REGION: Win32 Utility Functions
 namespace internal
 {
 #ifdef FS_WINDOWS_
 template<class T>
-void current_working_dir(T& path);
+void to_win32_path(T& path_str);
 
 template<>
-void current_working_dir(std::wstring& path)
+void to_win32_path(std::string& path_str)
 {
-	DWORD bufferSize = GetCurrentDirectoryW(0, 0)+1;
-	std::vector<wchar_t> buffer(bufferSize);
-	if (0==GetCurrentDirectoryW(bufferSize, &buffer[0]))
+	std::string::iterator it	= path_str.begin();
+	std::string::iterator itEnd	= path_str.end();
+	for (; it!=itEnd; ++it)
 	{
-		GENERARE_FILESYSTEM_ERROR0();
+		if (*it == '/')
+		{
+			*it = '\\';
+		}
 	}
-	path.assign(&buffer[0]);
 }
 
 template<>
-void current_working_dir(std::string& path)
+void to_win32_path(std::wstring& path_str)
 {
-	std::wstring wpath;
-	current_working_dir(wpath);
-	to_narrow_string(wpath, path);
+	std::wstring::iterator it		= path_str.begin();
+	std::wstring::iterator itEnd	= path_str.end();
+	for (; it!=itEnd; ++it)
+	{
+		if (*it == '/')
+		{
+			*it = '\\';
+		}
+	}
 }
-#endif //#ifdef FS_WINDOWS_
-#ifdef FS_POSIX_
+
 template<class T>
-void current_working_dir(T& path);
+void remove_extended_fs_indicator(T& path_str);
 
 template<>
-void current_working_dir(std::string& path)
+void remove_extended_fs_indicator(std::string& path_str)
 {
-	char* pbuffer = getcwd(0, 0);
-	path = pbuffer;
-	free(pbuffer);
+	std::string extended_fs_indicator("\\\\?\\");
+	if (path_str.find(extended_fs_indicator) == 0)
+	{
+		path_str.erase(0, extended_fs_indicator.size());
+	}
 }
 
 template<>
-void current_working_dir(std::wstring& path)
+void remove_extended_fs_indicator(std::wstring& path_str)
 {
-	std::string npath;
-	current_working_dir(npath);
-	to_wide_string(npath, path);
+	std::wstring extended_fs_indicator(L"\\\\?\\");
+	if (path_str.find(extended_fs_indicator) == 0)
+	{
+		path_str.erase(0, extended_fs_indicator.size());
+	}
 }
-#endif //#ifdef FS_POSIX_
-} //namespace internal
-#endif // REGION: current_working_dir
 
-#if 1 // REGION: full_pathname
-namespace internal
-{
-#ifdef FS_WINDOWS_
 template<class T>
-T full_pathname(const T& in);
+void prepend_extended_fs_indicator(T& path_str);
 
 template<>
-std::wstring full_pathname(const std::wstring& in)
+void prepend_extended_fs_indicator(std::wstring& path_str)
 {
-	std::wstring extended_in = in;
-	prepend_extended_fs_indicator(extended_in);
-	DWORD bufferSize = GetFullPathNameW(extended_in.c_str(), 0, 0, NULL);
-	std::vector<wchar_t> buffer(bufferSize);
-	if (0==GetFullPathNameW(extended_in.c_str(), bufferSize, &buffer[0], NULL))
+	// Prevent expansion if path contains "$" (indicating environment variable replacement)
+	if (path_str.find('$') != std::wstring::npos)
 	{
-		std::string nin;
-		to_narrow_string(in, nin);
-		GENERARE_FILESYSTEM_ERROR1(nin);
+		std::string npath;
+		to_narrow_string(path_str, npath);
+		throw filesystem_error("Path strings with environment variable indicators ('$') cannot be used in this context.", __FILE__, __LINE__, npath, "");
 	}
-	return std::wstring(&buffer[0]);
-}
 
-template<>
-std::string full_pathname(const std::string& in)
-{
-	std::wstring win;
-	to_wide_string(in, win);
-	std::wstring wresult = full_pathname(win);
-	std::string	result;
-	to_narrow_string(wresult, result);
-	return result;
+	// Don't bother if a path is less than (MAX_PATH-12) characters.
+	// MAX_PATH - 12 is needed when creating directories (due to the mandatory 8.3 minimum filename requirements).
+	// Source: http://msdn.microsoft.com/en-us/library/aa365247(VS.85).aspx#maxpath
+	if (path_str.size() < (MAX_PATH - 12))
+	{
+		return;	// if the path is empty, we'll return here...
+	}
+
+	// Prevent expansion if path contains "." or ".." elements.
+	// The extended indicator "\\?\" prevents expansion of "." and ".." path elements.
+	// Source: http://msdn.microsoft.com/en-us/library/aa365247(VS.85).aspx#maxpath
+	//
+	//	We don't have to worry about the path being exactly ".." or "." since these path
+	//	strings are too short and the function will return inside the previous if block.
+	//	We need to test for the following:
+	//	* occurrances of "\..\"
+	//	* occurrances of "\.\"
+	//	* occurrances of "..\" at the beginning of the path string
+	//	* occurrances of ".\" at the beginning of the path string
+	//	* occurrances of "\.." at the end of the path string
+	//	* occurrances of "\." at the end of the path string
+	if ((path_str.find(L"\\..\\") != std::wstring::npos) ||
+		(path_str.find(L"\\.\\") != std::wstring::npos) ||
+		(path_str.find(L"..\\") == 0) ||
+		(path_str.find(L".\\") == 0) ||
+		(path_str.find(L"\\..", path_str.size()-3) != std::wstring::npos) ||
+		(path_str.find(L"\\.", path_str.size()-2) != std::wstring::npos))
+	{
+		std::string npath;
+		to_narrow_string(path_str, npath);
+		throw filesystem_error("Path is too long to contain \".\" or \"..\".  Windows cannot properly expand the path string.", __FILE__, __LINE__, npath, "");
+	}
+
+	std::wstring extended_fs_indicator(L"\\\\?\\");
+	std::wstring extended_unc_indicator(L"\\\\?\\UNC");
+	if (path_str.find(extended_fs_indicator) != 0) // will also match the UNC extended filesystem indicator
+	{
+		if (path_str.find(L"\\\\") == 0) // "\\" found at the beginning of the string -- indicative of a UNC path
+		{
+			// "\\server\share" should become "\\?\UNC\server\share".
+			// Source: http://msdn.microsoft.com/en-us/library/aa365247(VS.85).aspx#maxpath
+			path_str.swap(extended_unc_indicator.append(path_str.begin()+1, path_str.end()));
+		}
+		else
+		{
+			path_str.swap(extended_fs_indicator.append(path_str));
+		}
+	}
 }
-#endif //#ifdef FS_WINDOWS_
-#ifdef FS_POSIX_
+
 template<class T>
-T full_pathname(const T& in);
+T cur_drive_path(const T& in);
 
 template<>
-std::string full_pathname(const std::string& in)
+std::wstring cur_drive_path(const std::wstring& in)
 {
-	char* buffer = realpath(in.c_str(), 0);
-	std::string result(buffer);
-	free(buffer);
-	return result;
+	std::wstring cpath;
+	int	drive, curdrive;
+
+	// Save current drive.
+	curdrive = _getdrive();
+
+	if ((in[0] >= 'A') && (in[0] <= 'Z'))
+	{
+		drive = 1 + (in[0] - 'A');
+	}
+	else if ((in[0] >= 'a') && (in[0] <= 'z'))
+	{
+		drive = 1 + (in[0] - 'a');
+	}
+	else
+	{
+		std::string nin;
+		to_narrow_string(in, nin);
+		GENERARE_FILESYSTEM_ERROR1(nin);
+	}
+
+	if(!_chdrive(drive))
+	{
+		wchar_t* buffer = _wgetdcwd(drive, 0, 0);
+
+		if (buffer == NULL)
+		{
+			std::string nin;
+			to_narrow_string(in, nin);
+			GENERARE_FILESYSTEM_ERROR1(nin);
+		}
+		cpath = buffer;
+		free(buffer);
+	}
+	else
+	{
+		std::string nin;
+		to_narrow_string(in, nin);
+		GENERARE_FILESYSTEM_ERROR1(nin);
+	}
+
+	_chdrive( curdrive ); // Restore original drive.
+
+	return cpath;
 }
 
 template<>
-std::wstring full_pathname(const std::wstring& in)
+std::string cur_drive_path(const std::string& in)
 {
-	std::string nin;
-	to_narrow_string(in, nin);
-	std::string nresult = full_pathname(nin);
-	std::wstring result;
-	to_wide_string(nresult, result);
+	std::string		result;
+	std::wstring	wresult = cur_drive_path(std::wstring(1, in[0]));
+	to_narrow_string(wresult, result);
 	return result;
 }
-#endif //#ifdef FS_POSIX_
+#endif //#ifdef FS_WINDOWS_
 } //namespace internal
-#endif // REGION: full_pathname
+#endif // REGION: Win32 Utility Functions
 
-#if 1 // REGION: is_directory_empty
+#if 1 // REGION: compare_path_element
 namespace internal
 {
 #ifdef FS_WINDOWS_
 template<class T>
-bool is_directory_empty(T dir);
+bool compare_path_element(T e1, T e2);
 
 template<>
-bool is_directory_empty(std::wstring dir)
+bool compare_path_element(std::string e1, std::string e2)
 {
-	bool result = true; // we'll assume the directory is empty
-
-	to_win32_path(dir);
-	prepend_extended_fs_indicator(dir);
-	dir.append(L"\\*");
-
-	WIN32_FIND_DATAW FindFileData;
-	HANDLE hFind;
-
-	hFind = FindFirstFileW(dir.c_str(), &FindFileData);
-	if (hFind == INVALID_HANDLE_VALUE) 
+	std::string::iterator it	= e1.begin();
+	std::string::iterator itEnd	= e1.end();
+	for (; it!=itEnd; ++it)
 	{
-		throw; // failed to access directory (directory doesn't exist?)
+		if (__isascii(*it) && isupper(*it))
+		{
+			*it = _tolower(*it);
+		}
 	}
-	BOOL foundEntry = TRUE;
-	do
+	it		= e2.begin();
+	itEnd	= e2.end();
+	for (; it!=itEnd; ++it)
 	{
-		if ((wcscmp(FindFileData.cFileName, L".") != 0) &&
-			(wcscmp(FindFileData.cFileName, L"..") != 0))
+		if (__isascii(*it) && isupper(*it))
 		{
-			result = false;
-			break;
+			*it = _tolower(*it);
 		}
-		foundEntry = FindNextFileW(hFind, &FindFileData);
 	}
-	while (foundEntry);
 
-	FindClose(hFind);
-	return result;
+	return (e1 == e2);
 }
 
 template<>
-bool is_directory_empty(std::string dir)
+bool compare_path_element(std::wstring e1, std::wstring e2)
 {
-	std::wstring wdir;
-	to_wide_string(dir, wdir);
-	return is_directory_empty(wdir);
+	std::wstring::iterator it		= e1.begin();
+	std::wstring::iterator itEnd	= e1.end();
+	for (; it!=itEnd; ++it)
+	{
+		*it = _tolower(*it);
+	}
+	it		= e2.begin();
+	itEnd	= e2.end();
+	for (; it!=itEnd; ++it)
+	{
+		*it = towlower(*it);
+	}
+
+	return (e1 == e2);
 }
 #endif //#ifdef FS_WINDOWS_
 #ifdef FS_POSIX_
 template<class T>
-bool is_directory_empty(T dir);
-
-template<>
-bool is_directory_empty(std::string directory)
+bool compare_path_element(T e1, T e2)
 {
-    DIR*			dir;
-    struct dirent*	ent;
-    struct stat		st;
-	bool			result = true;
-
-    dir = opendir(directory.c_str());
-	if (dir == NULL)
-	{
-		GENERARE_FILESYSTEM_ERROR1(directory);
-	}
-	while (result && ((ent = readdir(dir)) != NULL)) {
-		std::string file_name = ent->d_name;
-		std::string full_file_name = directory + "/" + file_name;
-		
-		if ((file_name == ".") || (file_name == ".."))
-			continue;
-			
-		if (stat(full_file_name.c_str(), &st) == -1)
-			continue;
-
-		result = false;
-	}
-    closedir(dir);
-	return result;
+	return (e1 == e2);
 }
+#endif //#ifdef FS_POSIX_
 
-template<>
-bool is_directory_empty(std::wstring dir)
+// Compares two elements in place, without copying them into strings.
+template<class T>
+bool compare_path_element(const T* e1, size_t e1_length, const T* e2, size_t e2_length)
 {
-	std::string ndir;
-	to_narrow_string(dir, ndir);
-	return is_directory_empty(ndir);
+	if (e1_length != e2_length)
+	{
+		return false;
+	}
+	#ifdef FS_WINDOWS_
+		for (size_t i=0; i<e1_length; ++i)
+		{
+			if (towlower(static_cast<wint_t>(e1[i])) != towlower(static_cast<wint_t>(e2[i])))
+			{
+				return false;
+			}
+		}
+		return true;
+	#endif //#ifdef FS_WINDOWS_
+	#ifdef FS_POSIX_
+		return std::equal(e1, e1 + e1_length, e2);
+	#endif //#ifdef FS_POSIX_
 }
-#endif //#ifdef FS_POSIX_
-} //namespace internal
-#endif // REGION: is_directory_empty
 
-#if 1 // REGION: is_file, is_directory
-namespace internal
-{
-#ifdef FS_WINDOWS_
+// Orders two elements consistently with compare_path_element(): negative if
+// e1 sorts first, zero if they are equal, positive otherwise.
 template<class T>
-bool is_file(const T&);
-
-template<>
-bool is_file(const std::wstring& path)
+int order_path_element(const T* e1, size_t e1_length, const T* e2, size_t e2_length)
 {
-	std::wstring ext_path = path;
-	to_win32_path(ext_path);
-	prepend_extended_fs_indicator(ext_path);
-
-	DWORD result = GetFileAttributesW(ext_path.c_str());
-	if ((result == INVALID_FILE_ATTRIBUTES) ||
-		((result & FILE_ATTRIBUTE_DEVICE) != 0) ||
-		((result & FILE_ATTRIBUTE_DIRECTORY) != 0) ||
-		((result & FILE_ATTRIBUTE_OFFLINE) != 0)) // For now, we won't allow access to offline files.
+	const size_t length = std::min(e1_length, e2_length);
+	for (size_t i=0; i<length; ++i)
 	{
-		DWORD result = GetFileAttributesW(ext_path.c_str());
-		if ((result == INVALID_FILE_ATTRIBUTES) ||
-			((result & FILE_ATTRIBUTE_DEVICE) != 0) ||
-			((result & FILE_ATTRIBUTE_DIRECTORY) != 0) ||
-			((result & FILE_ATTRIBUTE_OFFLINE) != 0)) // For now, we won't allow access to offline files.
+		#ifdef FS_WINDOWS_
+			const wint_t c1 = towlower(static_cast<wint_t>(e1[i]));
+			const wint_t c2 = towlower(static_cast<wint_t>(e2[i]));
+		#endif //#ifdef FS_WINDOWS_
+		#ifdef FS_POSIX_
+			const T c1 = e1[i];
+			const T c2 = e2[i];
+		#endif //#ifdef FS_POSIX_
+		if (c1 != c2)
 		{
-			return false;
+			return (c1 < c2) ? -1 : 1;
 		}
 	}
-	return true;
+	if (e1_length == e2_length)
+	{
+		return 0;
+	}
+	return (e1_length < e2_length) ? -1 : 1;
 }
 
-template<>
-bool is_file(const std::string& path)
+// Path hashes are FNV-1a over the elements, each followed by a separator, so
+// appending to a path only has to hash the new elements.  Characters are folded
+// the same way compare_path_element() compares them.
+const unsigned long long path_hash_seed		= 14695981039346656037ULL;
+const unsigned long long path_hash_prime	= 1099511628211ULL;
+
+template<class T>
+unsigned long long hash_path_element(unsigned long long hash, const T* e, size_t length)
 {
-	std::wstring wpath;
-	to_wide_string(path, wpath);
-	return is_file(wpath);
+	for (size_t i=0; i<length; ++i)
+	{
+		#ifdef FS_WINDOWS_
+			hash ^= static_cast<unsigned long long>(towlower(static_cast<wint_t>(e[i])));
+		#endif //#ifdef FS_WINDOWS_
+		#ifdef FS_POSIX_
+			hash ^= static_cast<unsigned long long>(e[i]);
+		#endif //#ifdef FS_POSIX_
+		hash *= path_hash_prime;
+	}
+	hash ^= static_cast<unsigned long long>('/');
+	hash *= path_hash_prime;
+	return hash;
 }
+} //namespace internal
+#endif // REGION: compare_path_element
 
+#if 1 // REGION: current_working_dir
+namespace internal
+{
+#ifdef FS_WINDOWS_
 template<class T>
-bool is_directory(const T&);
+void current_working_dir(T& path);
 
 template<>
-bool is_directory(const std::wstring& path)
+void current_working_dir(std::wstring& path)
 {
-	std::wstring ext_path = path;
-	to_win32_path(ext_path);
-	prepend_extended_fs_indicator(ext_path);
-
-	DWORD result = GetFileAttributesW(ext_path.c_str());
-	return ((result != INVALID_FILE_ATTRIBUTES) &&
-			((result & FILE_ATTRIBUTE_DIRECTORY) != 0));
+	DWORD bufferSize = GetCurrentDirectoryW(0, 0)+1;
+	std::vector<wchar_t> buffer(bufferSize);
+	if (0==GetCurrentDirectoryW(bufferSize, &buffer[0]))
+	{
+		GENERARE_FILESYSTEM_ERROR0();
+	}
+	path.assign(&buffer[0]);
 }
 
 template<>
-bool is_directory(const std::string& path)
+void current_working_dir(std::string& path)
 {
 	std::wstring wpath;
-	to_wide_string(path, wpath);
-	return is_directory(wpath);
+	current_working_dir(wpath);
+	to_narrow_string(wpath, path);
 }
 #endif //#ifdef FS_WINDOWS_
 #ifdef FS_POSIX_
 template<class T>
-bool is_file(const T&);
+void current_working_dir(T& path);
 
 template<>
-bool is_file(const std::string& path)
+void current_working_dir(std::string& path)
 {
-	struct stat	info;
-	if (lstat(path.c_str(), &info) != 0)
-	{
-		GENERARE_FILESYSTEM_ERROR1(path);
-	}
-	return S_ISREG(info.st_mode);
+	char* pbuffer = getcwd(0, 0);
+	path = pbuffer;
+	free(pbuffer);
 }
 
 template<>
-bool is_file(const std::wstring& path)
+void current_working_dir(std::wstring& path)
 {
 	std::string npath;
-	to_narrow_string(path, npath);
-	return is_file(npath);
+	current_working_dir(npath);
+	to_wide_string(npath, path);
 }
+#endif //#ifdef FS_POSIX_
+} //namespace internal
+#endif // REGION: current_working_dir
 
+#if 1 // REGION: full_pathname
+namespace internal
+{
+#ifdef FS_WINDOWS_
 template<class T>
-bool is_directory(const T&);
+T full_pathname(const T& in);
 
 template<>
-bool is_directory(const std::string& path)
+std::wstring full_pathname(const std::wstring& in)
 {
-	struct stat	info;
-	if (lstat(path.c_str(), &info) != 0)
+	std::wstring extended_in = in;
+	prepend_extended_fs_indicator(extended_in);
+	DWORD bufferSize = GetFullPathNameW(extended_in.c_str(), 0, 0, NULL);
+	std::vector<wchar_t> buffer(bufferSize);
+	if (0==GetFullPathNameW(extended_in.c_str(), bufferSize, &buffer[0], NULL))
 	{
-		GENERARE_FILESYSTEM_ERROR1(path);
+		std::string nin;
+		to_narrow_string(in, nin);
+		GENERARE_FILESYSTEM_ERROR1(nin);
 	}
-	return S_ISDIR(info.st_mode);
+	return std::wstring(&buffer[0]);
 }
 
 template<>
-bool is_directory(const std::wstring& path)
+std::string full_pathname(const std::string& in)
 {
-	std::string npath;
-	to_narrow_string(path, npath);
-	return is_directory(npath);
+	std::wstring win;
+	to_wide_string(in, win);
+	std::wstring wresult = full_pathname(win);
+	std::string	result;
+	to_narrow_string(wresult, result);
+	return result;
+}
+#endif //#ifdef FS_WINDOWS_
+#ifdef FS_POSIX_
+template<class T>
+T full_pathname(const T& in);
+
+template<>
+std::string full_pathname(const std::string& in)
+{
+	char* buffer = realpath(in.c_str(), 0);
+	std::string result(buffer);
+	free(buffer);
+	return result;
+}
+
+template<>
+std::wstring full_pathname(const std::wstring& in)
+{
+	std::string nin;
+	to_narrow_string(in, nin);
+	std::string nresult = full_pathname(nin);
+	std::wstring result;
+	to_wide_string(nresult, result);
+	return result;
 }
 #endif //#ifdef FS_POSIX_
 } //namespace internal
-#endif // REGION: is_file, is_directory
+#endif // REGION: full_pathname
 
-#if 1 // REGION: dir_get_subdirs, dir_get_files
+#if 1 // REGION: directory_handle
 namespace internal
 {
-#ifdef FS_WINDOWS_
-template<class T>
-void scan_directory(std::basic_string<T> dir, const std::basic_string<T>& pattern, std::vector<std::basic_string<T> >& results, bool search_directories);
+#ifdef FS_POSIX_
+inline bool is_dot_or_dot_dot(const char* name)
+{
+	return (name[0] == '.') &&
+		   ((name[1] == 0) || ((name[1] == '.') && (name[2] == 0)));
+}
 
-template<>
-void scan_directory(std::wstring dir, const std::wstring& pattern, std::vector<std::wstring>& results, bool search_directories)
+// Recursive walks keep a directory_handle open for each level down to this
+// depth; deeper directories are opened by full path once their parent is
+// closed, so a deep tree can't exhaust the file descriptor limit.
+const size_t max_handle_depth = 64;
+
+// An open directory file descriptor.  Entries are opened, examined and removed
+// relative to the descriptor (openat, fstatat, unlinkat), so the kernel resolves
+// only the entry name rather than walking the full path for every call.
+class directory_handle
 {
-	results.clear();
+	int fd;
 
-	DWORD fileAttrMask = FILE_ATTRIBUTE_DIRECTORY;
-	DWORD fileAttrComp = FILE_ATTRIBUTE_DIRECTORY;
-	if (!search_directories)
+	directory_handle(const directory_handle&);
+	directory_handle& operator=(const directory_handle&);
+
+public:
+	explicit directory_handle(const std::string& directory, bool follow_links = true)
+		: fd(open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC | (follow_links ? 0 : O_NOFOLLOW)))
 	{
-		fileAttrMask = FILE_ATTRIBUTE_DIRECTORY | FILE_ATTRIBUTE_DEVICE | FILE_ATTRIBUTE_OFFLINE;
-		fileAttrComp = 0;
+		if (fd == -1)
+		{
+			GENERARE_FILESYSTEM_ERROR1(directory);
+		}
 	}
 
-	to_win32_path(dir);
-	prepend_extended_fs_indicator(dir);
-	dir.push_back('\\');
-	if (pattern.empty())
+	// With follow_links false, a symbolic link named name is rejected (ELOOP)
+	// instead of opening the directory it points to.
+	directory_handle(const directory_handle& parent, const char* name, bool follow_links = true)
+		: fd(openat(parent.fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC | (follow_links ? 0 : O_NOFOLLOW)))
 	{
-		dir.push_back('*');
+		if (fd == -1)
+		{
+			GENERARE_FILESYSTEM_ERROR1(name);
+		}
 	}
-	else
+
+	~directory_handle()
 	{
-		dir.append(pattern);
+		close(fd);
 	}
 
-	WIN32_FIND_DATAW FindFileData;
-	HANDLE hFind;
-
-	hFind = FindFirstFileW(dir.c_str(), &FindFileData);
-	if (hFind == INVALID_HANDLE_VALUE) 
+	int native_handle() const
 	{
-		return;
+		return fd;
 	}
-	BOOL foundEntry = TRUE;
-	do
+
+	// Opens a new descriptor for the same directory.  Unlike dup(), the new
+	// descriptor has its own read position, so it can be given to fdopendir().
+	int reopen() const
 	{
-		if ((FindFileData.dwFileAttributes & fileAttrMask) == fileAttrComp)
+		int result = openat(fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (result == -1)
 		{
-			if ((wcscmp(FindFileData.cFileName, L".") != 0) &&
-				(wcscmp(FindFileData.cFileName, L"..") != 0))
-			{
-				results.push_back(FindFileData.cFileName);
-			}
+			GENERARE_FILESYSTEM_ERROR0();
 		}
-		foundEntry = FindNextFileW(hFind, &FindFileData);
+		return result;
 	}
-	while (foundEntry);
-
-	FindClose(hFind);
-}
-
-template<>
-void scan_directory(std::string dir, const std::string& pattern, std::vector<std::string>& results, bool search_directories)
-{
-	results.clear();
-
-	std::wstring wdir, wpattern;
-	std::vector<std::wstring> wsubdirs;
-
-	internal::to_wide_string(dir, wdir);
-	internal::to_wide_string(pattern, wpattern);
-
-	scan_directory(wdir, wpattern, wsubdirs, search_directories);
-
-	to_narrow_string(wsubdirs, results);
-}
-
-#endif //#ifdef FS_WINDOWS_
-#ifdef FS_POSIX_
-template<class T>
-void scan_directory(std::basic_string<T> directory, const std::basic_string<T>& pattern, std::vector<std::basic_string<T> >& results, bool search_directories);
-
-template<>
-void scan_directory(std::string directory, const std::string& pattern, std::vector<std::string>& results, bool search_directories)
-{
-	DIR *dir;
-	struct dirent *ent;
-	struct stat st;
-
-	const bool no_pattern = pattern.empty();
-
-	dir = opendir(directory.c_str());
-	while ((ent = readdir(dir)) != NULL) {
-		std::string file_name = ent->d_name;
-		std::string full_file_name = directory + "/" + file_name;
 
-		if ((file_name == ".") || (file_name == ".."))
-			continue;
-
-		if (stat(full_file_name.c_str(), &st) == -1)
-			continue;
+	bool stat(const char* name, struct stat& info, bool follow_links) const
+	{
+		return (fstatat(fd, name, &info, follow_links ? 0 : AT_SYMLINK_NOFOLLOW) == 0);
+	}
 
-		if (search_directories)
+	bool is_file(const char* name) const
+	{
+		struct stat	info;
+		if (!stat(name, info, false))
 		{
-			if (!S_ISDIR(st.st_mode)) // directory
-				continue;
+			GENERARE_FILESYSTEM_ERROR1(name);
 		}
-		else
+		return S_ISREG(info.st_mode);
+	}
+
+	bool is_directory(const char* name) const
+	{
+		struct stat	info;
+		if (!stat(name, info, false))
 		{
-			if (!S_ISREG(st.st_mode)) // file
-				continue;
+			GENERARE_FILESYSTEM_ERROR1(name);
 		}
+		return S_ISDIR(info.st_mode);
+	}
 
-		if (no_pattern || glob_match(file_name, pattern))
+	void remove_file(const char* name) const
+	{
+		if (unlinkat(fd, name, 0) != 0)
 		{
-			results.push_back(file_name);
+			GENERARE_FILESYSTEM_ERROR1(name);
 		}
 	}
-	closedir(dir);
-}
 
-template<>
-void scan_directory(std::wstring directory, const std::wstring& pattern, std::vector<std::wstring>& results, bool search_directories)
-{
-	results.clear();
+	void remove_directory(const char* name) const
+	{
+		if (unlinkat(fd, name, AT_REMOVEDIR) != 0)
+		{
+			GENERARE_FILESYSTEM_ERROR1(name);
+		}
+	}
 
-	std::string ndir, npattern;
-	std::vector<std::string> nsubdirs;
+	bool is_empty() const
+	{
+		int	dir_fd	= reopen();
+		DIR* dir	= fdopendir(dir_fd);
+		if (dir == NULL)
+		{
+			int error = errno;
+			close(dir_fd);
+			errno = error;
+			GENERARE_FILESYSTEM_ERROR0();
+		}
 
-	internal::to_narrow_string(directory, ndir);
-	internal::to_narrow_string(pattern, npattern);
+		struct dirent*	ent;
+		struct stat		st;
+		bool			result = true;
+		while (result && ((ent = readdir(dir)) != NULL))
+		{
+			if (is_dot_or_dot_dot(ent->d_name))
+				continue;
 
-	scan_directory(ndir, npattern, nsubdirs, search_directories);
+			if (fstatat(dir_fd, ent->d_name, &st, 0) == -1)
+				continue;
 
-	to_wide_string(nsubdirs, results);
-}
+			result = false;
+		}
+		closedir(dir);
+		return result;
+	}
+};
 #endif //#ifdef FS_POSIX_
+} //namespace internal
+#endif // REGION: directory_handle
 
+#if 1 // REGION: is_directory_empty
+namespace internal
+{
+#ifdef FS_WINDOWS_
 template<class T>
-void dir_get_subdirs(const T& dir, const T& pattern, std::vector<T>& results);
+bool is_directory_empty(T dir);
 
 template<>
-void dir_get_subdirs(const std::wstring& dir, const std::wstring& pattern, std::vector<std::wstring>& results)
+bool is_directory_empty(std::wstring dir)
 {
-	scan_directory(dir, pattern, results, true);
-}
-
-template<>
-void dir_get_subdirs(const std::string& dir, const std::string& pattern, std::vector<std::string>& results)
-{
-	scan_directory(dir, pattern, results, true);
-}
-
-template<class T>
-void dir_get_files(const T& dir, const T& pattern, std::vector<T>& results);
-
-template<>
-void dir_get_files(const std::wstring& dir, const std::wstring& pattern, std::vector<std::wstring>& results)
-{
-	scan_directory(dir, pattern, results, false);
-}
-
-template<>
-void dir_get_files(const std::string& dir, const std::string& pattern, std::vector<std::string>& results)
-{
-	scan_directory(dir, pattern, results, false);
-}
-} //namespace internal
-#endif // REGION: dir_get_subdirs, dir_get_files
+	bool result = true; // we'll assume the directory is empty
 
-#if 1 // REGION: create_directory, remove_directory
-namespace internal
-{
-#ifdef FS_WINDOWS_
-template<class T>
-void create_directory(const T& dir);
+	to_win32_path(dir);
+	prepend_extended_fs_indicator(dir);
+	dir.append(L"\\*");
 
-template<>
-void create_directory(const std::wstring& dir)
-{
-	std::wstring ext_dir = dir;
-	to_win32_path(ext_dir);
-	prepend_extended_fs_indicator(ext_dir);
+	WIN32_FIND_DATAW FindFileData;
+	HANDLE hFind;
 
-	if (0 == CreateDirectoryW(ext_dir.c_str(), NULL))
+	hFind = FindFirstFileW(dir.c_str(), &FindFileData);
+	if (hFind == INVALID_HANDLE_VALUE) 
 	{
-		std::string ndir;
-		to_narrow_string(dir, ndir);
-		GENERARE_FILESYSTEM_ERROR1(ndir);
+		throw; // failed to access directory (directory doesn't exist?)
 	}
+	BOOL foundEntry = TRUE;
+	do
+	{
+		if ((wcscmp(FindFileData.cFileName, L".") != 0) &&
+			(wcscmp(FindFileData.cFileName, L"..") != 0))
+		{
+			result = false;
+			break;
+		}
+		foundEntry = FindNextFileW(hFind, &FindFileData);
+	}
+	while (foundEntry);
+
+	FindClose(hFind);
+	return result;
 }
 
 template<>
-void create_directory(const std::string& dir)
+bool is_directory_empty(std::string dir)
 {
 	std::wstring wdir;
 	to_wide_string(dir, wdir);
-	create_directory(wdir);
+	return is_directory_empty(wdir);
 }
-
+#endif //#ifdef FS_WINDOWS_
+#ifdef FS_POSIX_
 template<class T>
-void remove_directory(const T& dir);
+bool is_directory_empty(T dir);
 
 template<>
-void remove_directory(const std::wstring& dir)
+bool is_directory_empty(std::string directory)
 {
-	std::wstring ext_dir = dir;
-	to_win32_path(ext_dir);
-	prepend_extended_fs_indicator(ext_dir);
-
-	if (0 == RemoveDirectoryW(ext_dir.c_str()))
-	{
-		std::string ndir;
-		to_narrow_string(dir, ndir);
-		GENERARE_FILESYSTEM_ERROR1(ndir);
-	}
+	return directory_handle(directory).is_empty();
 }
 
 template<>
-void remove_directory(const std::string& dir)
+bool is_directory_empty(std::wstring dir)
 {
+	std::string ndir;
+	to_narrow_string(dir, ndir);
+	return is_directory_empty(ndir);
 }
-#endif //#ifdef FS_WINDOWS_
-#ifdef FS_POSIX_
-template<class T>
-void create_directory(const T& dir);
+#endif //#ifdef FS_POSIX_
+} //namespace internal
+#endif // REGION: is_directory_empty
 
-template<>
-void create_directory(const std::string& dir)
+#if 1 // REGION: file_status
+// Selects which file_status fields a directory scan fills in.  Type and Inode
+// come with the directory entry itself; the others cost a stat per entry on
+// POSIX systems.
+struct EntryField
 {
-	if (mkdir(dir.c_str(), S_IRWXU | S_IRWXO | S_IRWXG) != 0)
+	enum Enum
 	{
-		GENERARE_FILESYSTEM_ERROR1(dir);
-	}
-}
+		Type	= 0x01,
+		Inode	= 0x02,
+		Size	= 0x04,
+		MTime	= 0x08,
+		Mode	= 0x10,
+		Device	= 0x20,
+
+		Basic	= Type | Inode,
+		All		= Type | Inode | Size | MTime | Mode | Device,
+	};
+};
 
-template<>
-void create_directory(const std::wstring& dir)
+struct FileType
 {
-	std::string ndir;
-	to_narrow_string(dir, ndir);
-	create_directory(ndir);
-}	
-
-template<class T>
-void remove_directory(const T& dir);
+	enum Enum
+	{
+		NotFound,
+		Regular,
+		Directory,
+		Symlink,
+		Other,		// device, fifo or socket
+	};
+};
 
-template<>
-void remove_directory(const std::string& dir)
+// The result of a single stat of a path.  Keep it around to answer several
+// questions about the same file without asking the file system again.
+class file_status
 {
-	if (rmdir(dir.c_str()) != 0)
+	FileType::Enum		file_type;
+	unsigned int		file_mode;
+	unsigned long long	file_size;
+	long long			mtime_seconds;
+	unsigned int		mtime_nanoseconds;
+	unsigned long long	file_inode;
+	unsigned long long	file_device;
+
+public:
+	file_status()
+		: file_type(FileType::NotFound)
+		, file_mode(0)
+		, file_size(0)
+		, mtime_seconds(0)
+		, mtime_nanoseconds(0)
+		, file_inode(0)
+		, file_device(0)
 	{
-		GENERARE_FILESYSTEM_ERROR1(dir);
 	}
-}
 
-template<>
-void remove_directory(const std::wstring& dir)
-{
-	std::string ndir;
-	to_narrow_string(dir, ndir);
-	remove_directory(ndir);
-}
-#endif //#ifdef FS_POSIX_
-} //namespace internal
-#endif // REGION: create_directory, remove_directory
+	file_status(FileType::Enum type_, unsigned int mode_, unsigned long long size_,
+				long long mtime_seconds_, unsigned int mtime_nanoseconds_,
+				unsigned long long inode_, unsigned long long device_)
+		: file_type(type_)
+		, file_mode(mode_)
+		, file_size(size_)
+		, mtime_seconds(mtime_seconds_)
+		, mtime_nanoseconds(mtime_nanoseconds_)
+		, file_inode(inode_)
+		, file_device(device_)
+	{
+	}
+
+	FileType::Enum type() const
+	{ return file_type;}
+
+	bool exists() const
+	{ return file_type != FileType::NotFound;}
+
+	bool is_file() const
+	{ return file_type == FileType::Regular;}
+
+	bool is_directory() const
+	{ return file_type == FileType::Directory;}
+
+	bool is_symlink() const
+	{ return file_type == FileType::Symlink;}
+
+	// Permission bits (07777).  On Windows only the read-only state is reflected.
+	unsigned int mode() const
+	{ return file_mode;}
+
+	unsigned long long size() const
+	{ return file_size;}
+
+	// Last modification time since the Unix epoch.
+	long long mtime() const
+	{ return mtime_seconds;}
+
+	unsigned int mtime_nsec() const
+	{ return mtime_nanoseconds;}
+
+	// Zero on Windows.
+	unsigned long long inode() const
+	{ return file_inode;}
+
+	// Zero on Windows.
+	unsigned long long device() const
+	{ return file_device;}
+};
 
-#if 1 // REGION: remove_file
 namespace internal
 {
+// Returns the status of path.  A missing path, or one with a missing parent,
+// is reported as FileType::NotFound rather than as an error.
 #ifdef FS_WINDOWS_
 template<class T>
-void remove_file(const T&);
+file_status get_status(const T& path, bool follow_links);
 
 template<>
-void remove_file(const std::wstring& path)
+inline file_status get_status(const std::wstring& path, bool follow_links)
 {
 	std::wstring ext_path = path;
 	to_win32_path(ext_path);
 	prepend_extended_fs_indicator(ext_path);
 
-	if (0 == DeleteFileW(ext_path.c_str()))
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	if (0 == GetFileAttributesExW(ext_path.c_str(), GetFileExInfoStandard, &data))
 	{
+		DWORD error = GetLastError();
+		if ((error == ERROR_FILE_NOT_FOUND) || (error == ERROR_PATH_NOT_FOUND))
+		{
+			return file_status();
+		}
 		std::string npath;
 		to_narrow_string(path, npath);
 		GENERARE_FILESYSTEM_ERROR1(npath);
 	}
+
+	FileType::Enum type = FileType::Regular;
+	if (!follow_links && ((data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) != 0))
+	{
+		type = FileType::Symlink;
+	}
+	else if ((data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0)
+	{
+		type = FileType::Directory;
+	}
+	else if ((data.dwFileAttributes & FILE_ATTRIBUTE_DEVICE) != 0)
+	{
+		type = FileType::Other;
+	}
+
+	// FILETIME counts 100ns intervals since 1601-01-01.
+	unsigned long long mtime = (static_cast<unsigned long long>(data.ftLastWriteTime.dwHighDateTime) << 32) | data.ftLastWriteTime.dwLowDateTime;
+	mtime -= 116444736000000000ULL;
+
+	return file_status(type,
+					   ((data.dwFileAttributes & FILE_ATTRIBUTE_READONLY) != 0) ? 0444 : 0666,
+					   (static_cast<unsigned long long>(data.nFileSizeHigh) << 32) | data.nFileSizeLow,
+					   static_cast<long long>(mtime / 10000000),
+					   static_cast<unsigned int>((mtime % 10000000) * 100),
+					   0,
+					   0);
 }
 
 template<>
-void remove_file(const std::string& path)
+inline file_status get_status(const std::string& path, bool follow_links)
 {
 	std::wstring wpath;
 	to_wide_string(path, wpath);
-	remove_file(wpath);
+	return get_status(wpath, follow_links);
 }
 #endif //#ifdef FS_WINDOWS_
 #ifdef FS_POSIX_
-template<class T>
-bool remove_file(const T& path);
-
-template<>
-bool remove_file(const std::string& path)
+inline FileType::Enum file_type_from_mode(unsigned int mode)
 {
-	if (unlink(path.c_str()) != 0)
+	if (S_ISREG(mode))
 	{
-		GENERARE_FILESYSTEM_ERROR1(path);
+		return FileType::Regular;
 	}
-	return true;
+	if (S_ISDIR(mode))
+	{
+		return FileType::Directory;
+	}
+	if (S_ISLNK(mode))
+	{
+		return FileType::Symlink;
+	}
+	return FileType::Other;
 }
 
-template<>
-bool remove_file(const std::wstring& path)
+inline file_status status_from_stat(const struct stat& info)
 {
-	std::string npath;
-	to_narrow_string(path, npath);
-	return remove_file(npath);
-}	
-#endif //#ifdef FS_POSIX_
-} //namespace internal
-#endif // REGION: remove_file
+	return file_status(file_type_from_mode(info.st_mode),
+					   info.st_mode & 07777,
+					   info.st_size,
+					   info.st_mtime,
+					   #ifdef FS_LINUX_
+						   info.st_mtim.tv_nsec,
+					   #else
+						   0,
+					   #endif //#ifdef FS_LINUX_
+					   info.st_ino,
+					   info.st_dev);
+}
 
-#if 1 // REGION: move
-namespace internal
+#ifdef FS_STATX_
+inline file_status status_from_statx(const struct statx& info)
 {
-#ifdef FS_WINDOWS_
-template<class T>
-void move(const T& oldpath, const T& newpath);
+	return file_status(file_type_from_mode(info.stx_mode),
+					   info.stx_mode & 07777,
+					   info.stx_size,
+					   info.stx_mtime.tv_sec,
+					   info.stx_mtime.tv_nsec,
+					   info.stx_ino,
+					   makedev(info.stx_dev_major, info.stx_dev_minor));
+}
 
-template<>
-void move(const std::wstring& oldpath, const std::wstring& newpath)
+// Converts a mask of EntryField values to the statx fields needed for them.
+inline unsigned int statx_mask(unsigned int fields)
 {
-	std::wstring ext_oldpath = oldpath;
-	to_win32_path(ext_oldpath);
-	prepend_extended_fs_indicator(ext_oldpath);
+	unsigned int mask = STATX_TYPE;
+	if ((fields & EntryField::Mode) != 0)	mask |= STATX_MODE;
+	if ((fields & EntryField::Inode) != 0)	mask |= STATX_INO;
+	if ((fields & EntryField::Size) != 0)	mask |= STATX_SIZE;
+	if ((fields & EntryField::MTime) != 0)	mask |= STATX_MTIME;
+	return mask;
+}
+#endif //#ifdef FS_STATX_
 
-	std::wstring ext_newpath = newpath;
-	to_win32_path(ext_newpath);
-	prepend_extended_fs_indicator(ext_newpath);
+// Stats name relative to the directory dir_fd (or AT_FDCWD).  fields is a mask
+// of EntryField values; with statx only those fields are requested from the
+// file system.  Returns false if the entry doesn't exist.
+inline bool stat_at(int dir_fd, const char* name, bool follow_links, unsigned int fields, file_status& status)
+{
+	#ifdef FS_STATX_
+		// statx fills in only the fields asked for, which can save file systems
+		// such as NFS from fetching attributes nobody reads.
+		const unsigned int mask = statx_mask(fields);
 
-	if (0 == MoveFileW(ext_oldpath.c_str(), ext_newpath.c_str()))
+		struct statx xinfo;
+		if (syscall(SYS_statx, dir_fd, name, follow_links ? 0 : AT_SYMLINK_NOFOLLOW, mask, &xinfo) == 0)
+		{
+			status = status_from_statx(xinfo);
+			return true;
+		}
+		// Sandboxes that filter statx refuse it with EPERM rather than ENOSYS.
+		if ((errno != ENOSYS) && (errno != EPERM))
+		{
+			return false;
+		}
+	#else
+		(void)fields;
+	#endif //#ifdef FS_STATX_
+
+	struct stat info;
+	if (fstatat(dir_fd, name, &info, follow_links ? 0 : AT_SYMLINK_NOFOLLOW) != 0)
 	{
-		std::string noldpath;
-		to_narrow_string(oldpath, noldpath);
-		std::string nnewpath;
-		to_narrow_string(newpath, nnewpath);
-		GENERARE_FILESYSTEM_ERROR2(noldpath, nnewpath);
+		return false;
 	}
+	status = status_from_stat(info);
+	return true;
 }
 
-template<>
-void move(const std::string& oldpath, const std::string& newpath)
-{
-	std::wstring woldpath, wnewpath;
-	to_wide_string(oldpath, woldpath);
-	to_wide_string(newpath, wnewpath);
-	move(woldpath, wnewpath);
-}
-#endif //#ifdef FS_WINDOWS_
-#ifdef FS_POSIX_
 template<class T>
-void move(const T& oldpath, const T& newpath);
+file_status get_status(const T& path, bool follow_links);
 
 template<>
-void move(const std::string& oldpath, const std::string& newpath)
+inline file_status get_status(const std::string& path, bool follow_links)
 {
-	if (rename(oldpath.c_str(), newpath.c_str()) != 0)
+	file_status status;
+	if (!stat_at(AT_FDCWD, path.c_str(), follow_links, EntryField::All, status))
 	{
-		GENERARE_FILESYSTEM_ERROR2(oldpath, newpath);
+		if ((errno != ENOENT) && (errno != ENOTDIR))
+		{
+			GENERARE_FILESYSTEM_ERROR1(path);
+		}
 	}
+	return status;
 }
 
 template<>
-void move(const std::wstring& oldpath, const std::wstring& newpath)
+inline file_status get_status(const std::wstring& path, bool follow_links)
 {
-	std::string noldpath, nnewpath;
-	to_narrow_string(oldpath, noldpath);
-	to_narrow_string(newpath, nnewpath);
-	move(noldpath, nnewpath);
+	std::string npath;
+	to_narrow_string(path, npath);
+	return get_status(npath, follow_links);
 }
 #endif //#ifdef FS_POSIX_
 } //namespace internal
-#endif // REGION: move
+#endif // REGION: file_status
 
-#if 1 // REGION: create_hard_link
+#if 1 // REGION: is_file, is_directory
 namespace internal
 {
 #ifdef FS_WINDOWS_
 template<class T>
-void create_hard_link(const T& link, const T& source);
+bool is_file(const T&);
 
 template<>
-void create_hard_link(const std::wstring& link, const std::wstring& source)
+bool is_file(const std::wstring& path)
 {
-	std::wstring ext_link = link;
-	to_win32_path(ext_link);
-	prepend_extended_fs_indicator(ext_link);
-
-	std::wstring ext_source = source;
-	to_win32_path(ext_source);
-	prepend_extended_fs_indicator(ext_source);
+	std::wstring ext_path = path;
+	to_win32_path(ext_path);
+	prepend_extended_fs_indicator(ext_path);
 
-	if (0 == CreateHardLinkW(ext_link.c_str(), ext_source.c_str(), NULL))
+	DWORD result = GetFileAttributesW(ext_path.c_str());
+	if ((result == INVALID_FILE_ATTRIBUTES) ||
+		((result & FILE_ATTRIBUTE_DEVICE) != 0) ||
+		((result & FILE_ATTRIBUTE_DIRECTORY) != 0) ||
+		((result & FILE_ATTRIBUTE_OFFLINE) != 0)) // For now, we won't allow access to offline files.
 	{
-		std::string nlink;
-		to_narrow_string(link, nlink);
-		std::string nsource;
-		to_narrow_string(source, nsource);
-		GENERARE_FILESYSTEM_ERROR2(nlink, nsource);
+		DWORD result = GetFileAttributesW(ext_path.c_str());
+		if ((result == INVALID_FILE_ATTRIBUTES) ||
+			((result & FILE_ATTRIBUTE_DEVICE) != 0) ||
+			((result & FILE_ATTRIBUTE_DIRECTORY) != 0) ||
+			((result & FILE_ATTRIBUTE_OFFLINE) != 0)) // For now, we won't allow access to offline files.
+		{
+			return false;
+		}
 	}
+	return true;
 }
 
 template<>
-void create_hard_link(const std::string& link, const std::string& source)
+bool is_file(const std::string& path)
 {
-	std::wstring wlink, wsource;
-	to_wide_string(link, wlink);
-	to_wide_string(source, wsource);
-	create_hard_link(wlink, wsource);
+	std::wstring wpath;
+	to_wide_string(path, wpath);
+	return is_file(wpath);
 }
-#endif //#ifdef FS_WINDOWS_
-#ifdef FS_POSIX_
+
 template<class T>
-void create_hard_link(const T& oldpath, const T& newpath);
+bool is_directory(const T&);
 
 template<>
-void create_hard_link(const std::string& oldpath, const std::string& newpath)
+bool is_directory(const std::wstring& path)
 {
-	if (link(oldpath.c_str(), newpath.c_str()) != 0)
-	{
-		GENERARE_FILESYSTEM_ERROR2(oldpath, newpath);
-	}
-}
+	std::wstring ext_path = path;
+	to_win32_path(ext_path);
+	prepend_extended_fs_indicator(ext_path);
 
-template<>
-void create_hard_link(const std::wstring& oldpath, const std::wstring& newpath)
-{
-	std::string noldpath, nnewpath;
-	to_narrow_string(oldpath, noldpath);
-	to_narrow_string(newpath, nnewpath);
-	create_hard_link(noldpath, nnewpath);
+	DWORD result = GetFileAttributesW(ext_path.c_str());
+	return ((result != INVALID_FILE_ATTRIBUTES) &&
+			((result & FILE_ATTRIBUTE_DIRECTORY) != 0));
 }
-#endif //#ifdef FS_POSIX_
-} //namespace internal
-#endif // REGION: create_hard_link
 
-#if 1 // REGION: exists
-namespace internal
+template<>
+bool is_directory(const std::string& path)
 {
-template<class T>
-bool exists(const T& path)
-{   
-	return is_directory(path) || is_file(path);
+	std::wstring wpath;
+	to_wide_string(path, wpath);
+	return is_directory(wpath);
 }
-} //namespace internal
-#endif // REGION: exists
-
-#if 1 // REGION: Win32 Junction Points
-#ifdef FS_WINDOWS_
-namespace internal
-{
+#endif //#ifdef FS_WINDOWS_
+#ifdef FS_POSIX_
 template<class T>
-bool create_junction_point(T link, T source);
+bool is_file(const T&);
 
 template<>
-bool create_junction_point(std::wstring link, std::wstring source)
+bool is_file(const std::string& path)
 {
-	if (link.empty() || source.empty())
-	{
-		return false;
-	}
-
-	to_win32_path(link);
-	prepend_extended_fs_indicator(link);
-
-	remove_extended_fs_indicator(source);
-	to_win32_path(source);
-	std::wstring(L"\\??\\").append(source).swap(source);
-
-	char raw_reparse_buffer[MAXIMUM_REPARSE_DATA_BUFFER_SIZE] = { 0 };
-	TMN_REPARSE_DATA_BUFFER& reparse_buffer = *reinterpret_cast<TMN_REPARSE_DATA_BUFFER*>(raw_reparse_buffer);
-
-	const WORD nDestMountPointBytes = static_cast<WORD>(source.size()) * 2;
-
-	reparse_buffer.ReparseTag           = IO_REPARSE_TAG_MOUNT_POINT;
-	reparse_buffer.ReparseDataLength    = nDestMountPointBytes + 12;
-	reparse_buffer.Reserved             = 0;
-	reparse_buffer.SubstituteNameOffset = 0;
-	reparse_buffer.SubstituteNameLength = nDestMountPointBytes;
-	reparse_buffer.PrintNameOffset      = nDestMountPointBytes + 2;
-	reparse_buffer.PrintNameLength      = 0;
-	lstrcpyW(reparse_buffer.PathBuffer, source.c_str());
-
-	HANDLE dirHandle = 
-			CreateFile(	link.c_str(),
-						GENERIC_READ | GENERIC_WRITE,
-						0,
-						0,
-						OPEN_EXISTING,
-						FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OPEN_REPARSE_POINT,
-						0);
-	if (dirHandle == INVALID_HANDLE_VALUE)
-	{
-		return false;
-	}
-
-	DWORD dummy;
-	return (0 !=
-		DeviceIoControl(dirHandle,
-						FSCTL_SET_REPARSE_POINT,
-						(LPVOID)&reparse_buffer,
-						reparse_buffer.ReparseDataLength + TMN_REPARSE_DATA_BUFFER_HEADER_SIZE,
-						NULL,
-						0,
-						&dummy,
-						0));
+	return get_status(path, false).is_file();
 }
 
 template<>
-bool create_junction_point(std::string link, std::string source)
+bool is_file(const std::wstring& path)
 {
-	std::wstring wlink, wsource;
-	to_wide_string(link, wlink);
-	to_wide_string(source, wsource);
-	return create_junction_point(wlink, wsource);
+	std::string npath;
+	to_narrow_string(path, npath);
+	return is_file(npath);
 }
 
 template<class T>
-bool is_junction_point(const T&);
+bool is_directory(const T&);
 
 template<>
-bool is_junction_point(const std::wstring& path)
+bool is_directory(const std::string& path)
 {
-	std::wstring ext_path = path;
-	to_win32_path(ext_path);
-	prepend_extended_fs_indicator(ext_path);
-
-	DWORD result = GetFileAttributesW(ext_path.c_str());
-	return ((result != INVALID_FILE_ATTRIBUTES) &&
-			((result & (FILE_ATTRIBUTE_DIRECTORY | FILE_ATTRIBUTE_REPARSE_POINT)) == (FILE_ATTRIBUTE_DIRECTORY | FILE_ATTRIBUTE_REPARSE_POINT)));
+	return get_status(path, false).is_directory();
 }
 
 template<>
-bool is_junction_point(const std::string& path)
+bool is_directory(const std::wstring& path)
 {
-	std::wstring wpath;
-	to_wide_string(path, wpath);
-	return is_junction_point(wpath);
-}
+	std::string npath;
+	to_narrow_string(path, npath);
+	return is_directory(npath);
 }
-#endif //#ifdef FS_WINDOWS_
-#endif // REGION: Win32 Junction Points
-
-#if 1 // REGION: class basic_path
+#endif //#ifdef FS_POSIX_
+} //namespace internal
+#endif // REGION: is_file, is_directory
 
-struct Initializer
+#if 1 // REGION: directory_scanner
+namespace internal
 {
-	enum Enum
+// Reads the entries of a single directory one at a time.  Entries "." and ".."
+// are skipped, and only files or only subdirectories are reported, optionally
+// filtered by a glob pattern.  Names are reported in the native string type.
+#ifdef FS_WINDOWS_
+class directory_scanner
+{
+	HANDLE				find_handle;
+	WIN32_FIND_DATAW	find_data;
+	bool				first_pending;
+	DWORD				attr_mask;
+	DWORD				attr_comp;
+	native_pattern_t	pattern;
+	std::wstring		current;
+
+	directory_scanner(const directory_scanner&);
+	directory_scanner& operator=(const directory_scanner&);
+
+public:
+	enum
 	{
-		CurrentWorkingDirectory,
+		default_buffer_size	= 1024 * 1024,
 	};
-};
 
-template<class T>
-class basic_path
-{
-public:
-	typedef T						char_t;
-	typedef std::basic_string<T>	string_t;
-	typedef std::vector<string_t>	vecstr_t;
+	// FindFirstFile only understands '*' and '?', so every entry is listed and
+	// names are matched against the compiled pattern here.  This keeps sets,
+	// escapes and case-sensitive patterns working the same as on POSIX.
+	directory_scanner(std::wstring dir, const native_pattern_t& pattern_, bool search_directories, size_t /*buffer_size*/ = default_buffer_size)
+		: find_handle(INVALID_HANDLE_VALUE)
+		, first_pending(false)
+		, attr_mask(FILE_ATTRIBUTE_DIRECTORY)
+		, attr_comp(FILE_ATTRIBUTE_DIRECTORY)
+		, pattern(pattern_)
+	{
+		if (!search_directories)
+		{
+			attr_mask = FILE_ATTRIBUTE_DIRECTORY | FILE_ATTRIBUTE_DEVICE | FILE_ATTRIBUTE_OFFLINE;
+			attr_comp = 0;
+		}
 
-private:
-	vecstr_t			path_elems;
-	mutable	string_t	path_string;
-	mutable bool		path_string_valid;
-	bool				relative;
-	bool				drive_specified;
-	bool				unc_path;
+		to_win32_path(dir);
+		prepend_extended_fs_indicator(dir);
+		dir.append(L"\\*");
 
-	void initialize(string_t path_)
-	{
-		#ifdef FS_WINDOWS_
-			internal::remove_extended_fs_indicator(path_);
-		#endif //#ifdef FS_WINDOWS_
+		find_handle = FindFirstFileW(dir.c_str(), &find_data);
+		first_pending = (find_handle != INVALID_HANDLE_VALUE);
+	}
 
-		if (path_.empty())
+	~directory_scanner()
+	{
+		if (find_handle != INVALID_HANDLE_VALUE)
 		{
-			throw filesystem_error("Path cannot be initialized to empty value", __FILE__, __LINE__, "", "");
+			FindClose(find_handle);
 		}
+	}
 
-		typename string_t::iterator it	 = path_.begin();
-		typename string_t::iterator itEnd = path_.end();
-		for (; it!=itEnd; ++it)
+	bool next()
+	{
+		while (find_handle != INVALID_HANDLE_VALUE)
 		{
-			if (*it == '\\')
+			if (first_pending)
 			{
-				*it = '/';
+				first_pending = false;
+			}
+			else if (!FindNextFileW(find_handle, &find_data))
+			{
+				FindClose(find_handle);
+				find_handle = INVALID_HANDLE_VALUE;
+				break;
+			}
+
+			if (((find_data.dwFileAttributes & attr_mask) == attr_comp) &&
+				(wcscmp(find_data.cFileName, L".") != 0) &&
+				(wcscmp(find_data.cFileName, L"..") != 0) &&
+				(pattern.empty() || pattern.match(find_data.cFileName, find_data.cFileName + wcslen(find_data.cFileName))))
+			{
+				current = find_data.cFileName;
+				return true;
 			}
 		}
+		return false;
+	}
 
-		if (path_.find(string_t(2, '/').c_str(), 1) != string_t::npos) // find "//"
+	const std::wstring& name() const
+	{
+		return current;
+	}
+
+	// Describes the current entry.  The find data already holds everything but
+	// the inode and device, so fields is ignored; filled reports what was set.
+	file_status status(unsigned int /*fields*/, unsigned int& filled) const
+	{
+		FileType::Enum type = FileType::Regular;
+		if ((find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0)
 		{
-			throw filesystem_error("Path encountered unexpected neighboring directory separators: '//'", __FILE__, __LINE__, "", "");
+			type = FileType::Directory;
 		}
-		if ((path_.find(string_t(3, '.').c_str()) == 0) &&
-			(path_.find_first_not_of('.') == string_t::npos)) // find repeats of elipses more than 2 in length
+		else if ((find_data.dwFileAttributes & FILE_ATTRIBUTE_DEVICE) != 0)
 		{
-			throw filesystem_error("Invalid path specified", __FILE__, __LINE__, "", "");
+			type = FileType::Other;
 		}
 
-		size_t searchIndex = 0;
-		size_t nextDelimiter = 0;
+		// FILETIME counts 100ns intervals since 1601-01-01.
+		unsigned long long mtime = (static_cast<unsigned long long>(find_data.ftLastWriteTime.dwHighDateTime) << 32) | find_data.ftLastWriteTime.dwLowDateTime;
+		mtime -= 116444736000000000ULL;
+
+		filled = EntryField::Type | EntryField::Size | EntryField::MTime | EntryField::Mode;
+		return file_status(type,
+						   ((find_data.dwFileAttributes & FILE_ATTRIBUTE_READONLY) != 0) ? 0444 : 0666,
+						   (static_cast<unsigned long long>(find_data.nFileSizeHigh) << 32) | find_data.nFileSizeLow,
+						   static_cast<long long>(mtime / 10000000),
+						   static_cast<unsigned int>((mtime % 10000000) * 100),
+						   0,
+						   0);
+	}
+};
+#endif //#ifdef FS_WINDOWS_
+#ifdef FS_POSIX_
+#ifdef FS_LINUX_
+// Record layout returned by the getdents64 system call.
+struct linux_dirent64
+{
+	unsigned long long	d_ino;
+	long long			d_off;
+	unsigned short		d_reclen;
+	unsigned char		d_type;
+	char				d_name[1];
+};
+#endif //#ifdef FS_LINUX_
 
-		// Detect non-relative and/or drive-specified paths
-		if (path_[0] == '/')
+class directory_scanner
+{
+#ifdef FS_LINUX_
+	// On Linux the directory is read with getdents64 directly into a buffer of
+	// up to buffer_limit bytes, and names are parsed in place.  The buffer starts
+	// small and only grows to the limit once a read fills it, so scanning many
+	// small directories doesn't pay for large allocations.
+	int					fd;
+	std::vector<char>	buffer;
+	size_t				buffer_limit;
+	size_t				buffer_offset;
+	size_t				buffer_filled;
+#else
+	DIR*				dir;
+#endif //#ifdef FS_LINUX_
+	native_pattern_t	pattern;
+	bool				search_directories;
+	std::string			current;
+	unsigned long long	current_inode;
+	mode_t				current_type;
+	struct stat			current_stat;		// set when the type needed a stat
+	bool				current_stat_valid;
+
+	directory_scanner(const directory_scanner&);
+	directory_scanner& operator=(const directory_scanner&);
+
+	void open_failed(int dir_fd)
+	{
+		int error = errno;
+		if (dir_fd != -1)
 		{
-			relative = false;
-			if (path_.length() == 1)
+			close(dir_fd);
+		}
+		errno = error;
+	}
+
+	void attach(int dir_fd, size_t buffer_size)
+	{
+		#ifdef FS_LINUX_
+			fd				= dir_fd;
+			buffer_limit	= (std::max)(buffer_size, static_cast<size_t>(minimum_buffer_size));
+			buffer.resize((std::min)(buffer_limit, static_cast<size_t>(initial_buffer_size)));
+		#else
+			(void)buffer_size;
+			dir = fdopendir(dir_fd);
+			if (dir == NULL)
 			{
-				// our path is "/".  We can short-cut and return.
-				path_elems.push_back(path_);
-				return;
+				open_failed(dir_fd);
+				GENERARE_FILESYSTEM_ERROR0();
 			}
-			if (path_[1] == '/')
+		#endif //#ifdef FS_LINUX_
+	}
+
+	int native_fd() const
+	{
+		#ifdef FS_LINUX_
+			return fd;
+		#else
+			return dirfd(dir);
+		#endif //#ifdef FS_LINUX_
+	}
+
+	// Reads the next raw entry, including "." and "..".  d_type is DT_UNKNOWN
+	// when the platform doesn't report entry types.
+	bool read_entry(const char*& name, unsigned char& d_type, unsigned long long& inode)
+	{
+		#ifdef FS_LINUX_
+			if (buffer_offset >= buffer_filled)
 			{
-				// we have a UNC path
-				unc_path = true;
-				nextDelimiter = path_.find('/', 2);
-				if (nextDelimiter == string_t::npos)
+				if (fd == -1)
 				{
-					// we only have the root path.  We can short-cut and return.
-					path_elems.push_back(path_);
+					return false;
+				}
+				if ((buffer_filled + 512 > buffer.size()) && (buffer.size() < buffer_limit))
+				{
+					buffer.resize(buffer_limit); // the last read filled the buffer; expect a large directory
+				}
+				long bytes = syscall(SYS_getdents64, fd, &buffer[0], buffer.size());
+				if (bytes <= 0)
+				{
+					close(fd);
+					fd = -1;
+					return false;
+				}
+				buffer_offset = 0;
+				buffer_filled = static_cast<size_t>(bytes);
+			}
+			const linux_dirent64* ent = reinterpret_cast<const linux_dirent64*>(&buffer[buffer_offset]);
+			buffer_offset += ent->d_reclen;
+			name	= ent->d_name;
+			d_type	= ent->d_type;
+			inode	= ent->d_ino;
+			return true;
+		#else
+			struct dirent* ent;
+			if ((dir == NULL) || ((ent = readdir(dir)) == NULL))
+			{
+				return false;
+			}
+			name	= ent->d_name;
+			inode	= ent->d_ino;
+			#ifdef DT_UNKNOWN
+				d_type = ent->d_type;
+			#else
+				d_type = 0;
+			#endif //#ifdef DT_UNKNOWN
+			return true;
+		#endif //#ifdef FS_LINUX_
+	}
+
+	// Determines the file type of an entry (S_IFDIR, S_IFREG, ...).  Most
+	// filesystems report the type in d_type, so no stat() is needed.  Symbolic
+	// links are followed, and entries that can't be resolved (e.g. dangling
+	// links or entries removed since the read) are rejected.  A stat made here
+	// is kept in current_stat.
+	bool entry_type(const char* name, unsigned char d_type, mode_t& type)
+	{
+		#ifdef DT_UNKNOWN
+			switch (d_type)
+			{
+				case DT_DIR:	type = S_IFDIR;		return true;
+				case DT_REG:	type = S_IFREG;		return true;
+				case DT_FIFO:	type = S_IFIFO;		return true;
+				case DT_CHR:	type = S_IFCHR;		return true;
+				case DT_BLK:	type = S_IFBLK;		return true;
+				case DT_SOCK:	type = S_IFSOCK;	return true;
+				default:		break; // DT_UNKNOWN or DT_LNK
+			}
+		#else
+			(void)d_type;
+		#endif //#ifdef DT_UNKNOWN
+
+		if (fstatat(native_fd(), name, &current_stat, 0) == -1)
+		{
+			return false;
+		}
+		current_stat_valid = true;
+		type = current_stat.st_mode & S_IFMT;
+		return true;
+	}
+
+public:
+	enum
+	{
+		initial_buffer_size	= 32 * 1024,
+		minimum_buffer_size	= 4 * 1024,
+		default_buffer_size	= 1024 * 1024,
+	};
+
+	directory_scanner(const std::string& directory, const native_pattern_t& pattern_, bool search_directories_, size_t buffer_size = default_buffer_size)
+		#ifdef FS_LINUX_
+		: fd(-1)
+		, buffer_limit(0)
+		, buffer_offset(0)
+		, buffer_filled(0)
+		#else
+		: dir(NULL)
+		#endif //#ifdef FS_LINUX_
+		, pattern(pattern_)
+		, search_directories(search_directories_)
+		, current_inode(0)
+		, current_type(0)
+		, current_stat_valid(false)
+	{
+		int dir_fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (dir_fd == -1)
+		{
+			GENERARE_FILESYSTEM_ERROR1(directory);
+		}
+		attach(dir_fd, buffer_size);
+	}
+
+	directory_scanner(const directory_handle& directory, const native_pattern_t& pattern_, bool search_directories_, size_t buffer_size = default_buffer_size)
+		#ifdef FS_LINUX_
+		: fd(-1)
+		, buffer_limit(0)
+		, buffer_offset(0)
+		, buffer_filled(0)
+		#else
+		: dir(NULL)
+		#endif //#ifdef FS_LINUX_
+		, pattern(pattern_)
+		, search_directories(search_directories_)
+		, current_inode(0)
+		, current_type(0)
+		, current_stat_valid(false)
+	{
+		attach(directory.reopen(), buffer_size);
+	}
+
+	~directory_scanner()
+	{
+		#ifdef FS_LINUX_
+			if (fd != -1)
+			{
+				close(fd);
+			}
+		#else
+			if (dir != NULL)
+			{
+				closedir(dir);
+			}
+		#endif //#ifdef FS_LINUX_
+	}
+
+	bool next()
+	{
+		const char*		file_name;
+		unsigned char	d_type;
+
+		while (read_entry(file_name, d_type, current_inode))
+		{
+			if (is_dot_or_dot_dot(file_name))
+				continue;
+
+			current_stat_valid = false;
+			if (!entry_type(file_name, d_type, current_type))
+				continue;
+
+			const mode_t type = current_type;
+
+			if (search_directories)
+			{
+				if (!S_ISDIR(type)) // directory
+					continue;
+			}
+			else
+			{
+				if (!S_ISREG(type)) // file
+					continue;
+			}
+
+			// The name is only copied out of the read buffer once it matches.
+			if (pattern.empty() ||
+				pattern.match(file_name, file_name + strlen(file_name)))
+			{
+				current = file_name;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	const std::string& name() const
+	{
+		return current;
+	}
+
+	// Describes the current entry, following symbolic links as the scan does.
+	// The type and inode come from the directory read; other fields cost a
+	// statx of the entry unless its type already needed a stat.  filled
+	// reports the EntryField values that were set.
+	file_status status(unsigned int fields, unsigned int& filled) const
+	{
+		if (current_stat_valid)
+		{
+			filled = EntryField::All;
+			return status_from_stat(current_stat);
+		}
+
+		file_status result;
+		if (((fields & ~EntryField::Basic) != 0) &&
+			stat_at(native_fd(), current.c_str(), true, fields | EntryField::Basic, result))
+		{
+			filled = fields | EntryField::Basic;
+			return result;
+		}
+
+		filled = EntryField::Basic;
+		return file_status(file_type_from_mode(current_type), 0, 0, 0, 0, current_inode, 0);
+	}
+};
+#endif //#ifdef FS_POSIX_
+} //namespace internal
+#endif // REGION: directory_scanner
+
+#if 1 // REGION: dir_get_subdirs, dir_get_files
+namespace internal
+{
+template<class T>
+void scan_directory(const std::basic_string<T>& directory, const std::basic_string<T>& pattern, std::vector<std::basic_string<T> >& results, bool search_directories)
+{
+	results.clear();
+
+	native_string_t ndirectory;
+	convert_string(directory, ndirectory);
+
+	directory_scanner		scanner(ndirectory, to_native_pattern(pattern), search_directories);
+	std::basic_string<T>	name;
+	while (scanner.next())
+	{
+		convert_string(scanner.name(), name);
+		results.push_back(name);
+	}
+}
+
+// Scans a directory once and sorts the entries into one bucket per pattern of
+// the set.  An entry matching several patterns appears in each of their buckets.
+template<class T>
+void scan_directory(const std::basic_string<T>& directory, const basic_glob_set<T>& patterns, std::vector<std::vector<std::basic_string<T> > >& results, bool search_directories)
+{
+	results.clear();
+	results.resize(patterns.size());
+
+	native_string_t ndirectory;
+	convert_string(directory, ndirectory);
+
+	// Match against native names, so only matching names are converted.
+	basic_glob_set<native_string_t::value_type> npatterns(patterns.is_case_insensitive());
+	native_string_t npattern;
+	for (size_t i=0; i<patterns.size(); ++i)
+	{
+		convert_string(patterns.pattern(i), npattern);
+		npatterns.add(npattern);
+	}
+
+	directory_scanner		scanner(ndirectory, native_pattern_t(), search_directories);
+	std::basic_string<T>	name;
+	while (scanner.next())
+	{
+		const native_string_t&				nname	= scanner.name();
+		typename basic_glob_set<T>::mask_t	mask	= npatterns.match(nname);
+		if (mask == 0)
+		{
+			continue;
+		}
+		convert_string(nname, name);
+		for (size_t i=0; mask!=0; ++i, mask>>=1)
+		{
+			if (mask & 1)
+			{
+				results[i].push_back(name);
+			}
+		}
+	}
+}
+
+template<class T>
+void dir_get_subdirs(const T& dir, const T& pattern, std::vector<T>& results);
+
+template<>
+void dir_get_subdirs(const std::wstring& dir, const std::wstring& pattern, std::vector<std::wstring>& results)
+{
+	scan_directory(dir, pattern, results, true);
+}
+
+template<>
+void dir_get_subdirs(const std::string& dir, const std::string& pattern, std::vector<std::string>& results)
+{
+	scan_directory(dir, pattern, results, true);
+}
+
+template<class T>
+void dir_get_files(const T& dir, const T& pattern, std::vector<T>& results);
+
+template<>
+void dir_get_files(const std::wstring& dir, const std::wstring& pattern, std::vector<std::wstring>& results)
+{
+	scan_directory(dir, pattern, results, false);
+}
+
+template<>
+void dir_get_files(const std::string& dir, const std::string& pattern, std::vector<std::string>& results)
+{
+	scan_directory(dir, pattern, results, false);
+}
+} //namespace internal
+#endif // REGION: dir_get_subdirs, dir_get_files
+
+#if 1 // REGION: create_directory, remove_directory
+namespace internal
+{
+#ifdef FS_WINDOWS_
+template<class T>
+void create_directory(const T& dir);
+
+template<>
+void create_directory(const std::wstring& dir)
+{
+	std::wstring ext_dir = dir;
+	to_win32_path(ext_dir);
+	prepend_extended_fs_indicator(ext_dir);
+
+	if (0 == CreateDirectoryW(ext_dir.c_str(), NULL))
+	{
+		std::string ndir;
+		to_narrow_string(dir, ndir);
+		GENERARE_FILESYSTEM_ERROR1(ndir);
+	}
+}
+
+template<>
+void create_directory(const std::string& dir)
+{
+	std::wstring wdir;
+	to_wide_string(dir, wdir);
+	create_directory(wdir);
+}
+
+template<class T>
+void remove_directory(const T& dir);
+
+template<>
+void remove_directory(const std::wstring& dir)
+{
+	std::wstring ext_dir = dir;
+	to_win32_path(ext_dir);
+	prepend_extended_fs_indicator(ext_dir);
+
+	if (0 == RemoveDirectoryW(ext_dir.c_str()))
+	{
+		std::string ndir;
+		to_narrow_string(dir, ndir);
+		GENERARE_FILESYSTEM_ERROR1(ndir);
+	}
+}
+
+template<>
+void remove_directory(const std::string& dir)
+{
+}
+#endif //#ifdef FS_WINDOWS_
+#ifdef FS_POSIX_
+template<class T>
+void create_directory(const T& dir);
+
+template<>
+void create_directory(const std::string& dir)
+{
+	if (mkdir(dir.c_str(), S_IRWXU | S_IRWXO | S_IRWXG) != 0)
+	{
+		GENERARE_FILESYSTEM_ERROR1(dir);
+	}
+}
+
+template<>
+void create_directory(const std::wstring& dir)
+{
+	std::string ndir;
+	to_narrow_string(dir, ndir);
+	create_directory(ndir);
+}	
+
+template<class T>
+void remove_directory(const T& dir);
+
+template<>
+void remove_directory(const std::string& dir)
+{
+	if (rmdir(dir.c_str()) != 0)
+	{
+		GENERARE_FILESYSTEM_ERROR1(dir);
+	}
+}
+
+template<>
+void remove_directory(const std::wstring& dir)
+{
+	std::string ndir;
+	to_narrow_string(dir, ndir);
+	remove_directory(ndir);
+}
+#endif //#ifdef FS_POSIX_
+} //namespace internal
+#endif // REGION: create_directory, remove_directory
+
+#if 1 // REGION: create_directories
+namespace internal
+{
+struct MakeDirectory
+{
+	enum Enum
+	{
+		Created,
+		Exists,
+		ParentMissing,
+	};
+};
+
+// Creates a single directory.  Failures other than an existing entry or a
+// missing parent are thrown.
+inline MakeDirectory::Enum make_directory(const native_string_t& dir)
+{
+	#ifdef FS_WINDOWS_
+		std::wstring ext_dir = dir;
+		to_win32_path(ext_dir);
+		prepend_extended_fs_indicator(ext_dir);
+		if (0 != CreateDirectoryW(ext_dir.c_str(), NULL))
+		{
+			return MakeDirectory::Created;
+		}
+		DWORD error = GetLastError();
+		if (error == ERROR_ALREADY_EXISTS)
+		{
+			return MakeDirectory::Exists;
+		}
+		if (error == ERROR_PATH_NOT_FOUND)
+		{
+			return MakeDirectory::ParentMissing;
+		}
+		std::string ndir;
+		to_narrow_string(dir, ndir);
+		GENERARE_FILESYSTEM_ERROR1(ndir);
+	#endif //#ifdef FS_WINDOWS_
+	#ifdef FS_POSIX_
+		if (mkdir(dir.c_str(), S_IRWXU | S_IRWXO | S_IRWXG) == 0)
+		{
+			return MakeDirectory::Created;
+		}
+		if (errno == EEXIST)
+		{
+			return MakeDirectory::Exists;
+		}
+		if (errno == ENOENT)
+		{
+			return MakeDirectory::ParentMissing;
+		}
+		GENERARE_FILESYSTEM_ERROR1(dir);
+	#endif //#ifdef FS_POSIX_
+	return MakeDirectory::Exists;
+}
+
+// Creates dir and any missing parents, returning how many were created.  The
+// deepest directory is tried first, and parents are only visited when it
+// fails because they are missing.  An existing directory, including one made
+// by a concurrent creator, counts as success.  known, if given, lists
+// directories known to exist, which are never tried, and receives the
+// parents of dir.
+inline size_t create_directories(const native_string_t& dir, std::set<native_string_t>* known)
+{
+	std::vector<size_t>	pending;	// lengths of the prefixes still to create, deepest first
+	size_t				end		= dir.size();
+	size_t				created	= 0;
+	for (;;)
+	{
+		const native_string_t prefix(dir, 0, end);
+		if ((known != 0) && (known->count(prefix) != 0))
+		{
+			break;
+		}
+
+		MakeDirectory::Enum result = make_directory(prefix);
+		if (result == MakeDirectory::Created)
+		{
+			++created;
+			break;
+		}
+		if (result == MakeDirectory::Exists)
+		{
+			// A parent that is really a file makes the next mkdir fail anyway,
+			// so only the requested directory itself needs checking.
+			if (pending.empty() && !get_status(prefix, true).is_directory())
+			{
+				std::string nprefix;
+				convert_string(prefix, nprefix);
+				throw filesystem_error("Path exists but is not a directory", __FILE__, __LINE__, nprefix, "");
+			}
+			break;
+		}
+
+		const size_t slash = (end > 1) ? dir.rfind('/', end - 1) : native_string_t::npos;
+		if ((slash == native_string_t::npos) || (slash == 0) || (dir[slash - 1] == ':') || (dir[slash - 1] == '/'))
+		{
+			// The root, drive or share is missing.
+			std::string nprefix;
+			convert_string(prefix, nprefix);
+			throw filesystem_error("Parent directory does not exist", __FILE__, __LINE__, nprefix, "");
+		}
+		pending.push_back(end);
+		end = slash;
+	}
+
+	for (size_t i=pending.size(); i>0; --i)
+	{
+		const native_string_t	prefix(dir, 0, pending[i-1]);
+		MakeDirectory::Enum		result = make_directory(prefix);
+		if (result == MakeDirectory::Created)
+		{
+			++created;
+		}
+		else if ((result == MakeDirectory::ParentMissing) ||
+				 ((i == 1) && !get_status(prefix, true).is_directory()))
+		{
+			std::string nprefix;
+			convert_string(prefix, nprefix);
+			throw filesystem_error((result == MakeDirectory::ParentMissing) ? "Parent directory was removed" : "Path exists but is not a directory", __FILE__, __LINE__, nprefix, "");
+		}
+	}
+
+	if (known != 0)
+	{
+		for (size_t pos=dir.find('/', 1); pos!=native_string_t::npos; pos=dir.find('/', pos + 1))
+		{
+			known->insert(native_string_t(dir, 0, pos));
+		}
+		known->insert(dir);
+	}
+	return created;
+}
+
+// Creates each directory of dirs with its missing parents.  Sorting groups
+// directories under the same parents, which are then created only once.
+inline size_t create_directories(std::vector<native_string_t>& dirs)
+{
+	std::sort(dirs.begin(), dirs.end());
+
+	std::set<native_string_t>	known;
+	size_t						created = 0;
+	for (size_t i=0; i<dirs.size(); ++i)
+	{
+		created += create_directories(dirs[i], &known);
+	}
+	return created;
+}
+} //namespace internal
+#endif // REGION: create_directories
+
+#if 1 // REGION: remove_file
+namespace internal
+{
+#ifdef FS_WINDOWS_
+template<class T>
+void remove_file(const T&);
+
+template<>
+void remove_file(const std::wstring& path)
+{
+	std::wstring ext_path = path;
+	to_win32_path(ext_path);
+	prepend_extended_fs_indicator(ext_path);
+
+	if (0 == DeleteFileW(ext_path.c_str()))
+	{
+		std::string npath;
+		to_narrow_string(path, npath);
+		GENERARE_FILESYSTEM_ERROR1(npath);
+	}
+}
+
+template<>
+void remove_file(const std::string& path)
+{
+	std::wstring wpath;
+	to_wide_string(path, wpath);
+	remove_file(wpath);
+}
+#endif //#ifdef FS_WINDOWS_
+#ifdef FS_POSIX_
+template<class T>
+bool remove_file(const T& path);
+
+template<>
+bool remove_file(const std::string& path)
+{
+	if (unlink(path.c_str()) != 0)
+	{
+		GENERARE_FILESYSTEM_ERROR1(path);
+	}
+	return true;
+}
+
+template<>
+bool remove_file(const std::wstring& path)
+{
+	std::string npath;
+	to_narrow_string(path, npath);
+	return remove_file(npath);
+}	
+#endif //#ifdef FS_POSIX_
+} //namespace internal
+#endif // REGION: remove_file
+
+#if 1 // REGION: move
+namespace internal
+{
+#ifdef FS_WINDOWS_
+template<class T>
+void move(const T& oldpath, const T& newpath);
+
+template<>
+void move(const std::wstring& oldpath, const std::wstring& newpath)
+{
+	std::wstring ext_oldpath = oldpath;
+	to_win32_path(ext_oldpath);
+	prepend_extended_fs_indicator(ext_oldpath);
+
+	std::wstring ext_newpath = newpath;
+	to_win32_path(ext_newpath);
+	prepend_extended_fs_indicator(ext_newpath);
+
+	if (0 == MoveFileW(ext_oldpath.c_str(), ext_newpath.c_str()))
+	{
+		std::string noldpath;
+		to_narrow_string(oldpath, noldpath);
+		std::string nnewpath;
+		to_narrow_string(newpath, nnewpath);
+		GENERARE_FILESYSTEM_ERROR2(noldpath, nnewpath);
+	}
+}
+
+template<>
+void move(const std::string& oldpath, const std::string& newpath)
+{
+	std::wstring woldpath, wnewpath;
+	to_wide_string(oldpath, woldpath);
+	to_wide_string(newpath, wnewpath);
+	move(woldpath, wnewpath);
+}
+#endif //#ifdef FS_WINDOWS_
+#ifdef FS_POSIX_
+template<class T>
+void move(const T& oldpath, const T& newpath);
+
+template<>
+void move(const std::string& oldpath, const std::string& newpath)
+{
+	if (rename(oldpath.c_str(), newpath.c_str()) != 0)
+	{
+		GENERARE_FILESYSTEM_ERROR2(oldpath, newpath);
+	}
+}
+
+template<>
+void move(const std::wstring& oldpath, const std::wstring& newpath)
+{
+	std::string noldpath, nnewpath;
+	to_narrow_string(oldpath, noldpath);
+	to_narrow_string(newpath, nnewpath);
+	move(noldpath, nnewpath);
+}
+#endif //#ifdef FS_POSIX_
+} //namespace internal
+#endif // REGION: move
+
+#if 1 // REGION: create_hard_link
+namespace internal
+{
+#ifdef FS_WINDOWS_
+template<class T>
+void create_hard_link(const T& link, const T& source);
+
+template<>
+void create_hard_link(const std::wstring& link, const std::wstring& source)
+{
+	std::wstring ext_link = link;
+	to_win32_path(ext_link);
+	prepend_extended_fs_indicator(ext_link);
+
+	std::wstring ext_source = source;
+	to_win32_path(ext_source);
+	prepend_extended_fs_indicator(ext_source);
+
+	if (0 == CreateHardLinkW(ext_link.c_str(), ext_source.c_str(), NULL))
+	{
+		std::string nlink;
+		to_narrow_string(link, nlink);
+		std::string nsource;
+		to_narrow_string(source, nsource);
+		GENERARE_FILESYSTEM_ERROR2(nlink, nsource);
+	}
+}
+
+template<>
+void create_hard_link(const std::string& link, const std::string& source)
+{
+	std::wstring wlink, wsource;
+	to_wide_string(link, wlink);
+	to_wide_string(source, wsource);
+	create_hard_link(wlink, wsource);
+}
+#endif //#ifdef FS_WINDOWS_
+#ifdef FS_POSIX_
+template<class T>
+void create_hard_link(const T& oldpath, const T& newpath);
+
+template<>
+void create_hard_link(const std::string& oldpath, const std::string& newpath)
+{
+	if (link(oldpath.c_str(), newpath.c_str()) != 0)
+	{
+		GENERARE_FILESYSTEM_ERROR2(oldpath, newpath);
+	}
+}
+
+template<>
+void create_hard_link(const std::wstring& oldpath, const std::wstring& newpath)
+{
+	std::string noldpath, nnewpath;
+	to_narrow_string(oldpath, noldpath);
+	to_narrow_string(newpath, nnewpath);
+	create_hard_link(noldpath, nnewpath);
+}
+#endif //#ifdef FS_POSIX_
+} //namespace internal
+#endif // REGION: create_hard_link
+
+#if 1 // REGION: copy_file
+struct CopyOption
+{
+	enum Enum
+	{
+		None				= 0x00,
+		Overwrite			= 0x01,	// replace an existing destination instead of failing
+		PreserveMetadata	= 0x02,	// copy permission bits and access/modification times
+	};
+};
+
+namespace internal
+{
+#ifdef FS_POSIX_
+// Copies the rest of in to out, from their current file positions.  Returns 0
+// or an errno value.  Each method falls back to the next when the kernel or
+// file system doesn't support it, continuing from wherever it stopped.
+inline int copy_file_data(int in, int out, const struct stat& in_info)
+{
+	#ifdef FS_LINUX_
+		// Files like those in /proc report a size of 0 and can only be read.
+		if (in_info.st_size > 0)
+		{
+			// A reflink shares the source's blocks on copy-on-write file systems
+			// (btrfs, XFS), so the copy takes constant time.
+			if (ioctl(out, FICLONE, in) == 0)
+			{
+				return 0;
+			}
+
+			// copy_file_range stays in the kernel, and may be offloaded to the
+			// file system or the storage (NFS server-side copy, for example).
+			bool use_sendfile = true;
+			#ifdef SYS_copy_file_range
+				for (;;)
+				{
+					long copied = syscall(SYS_copy_file_range, in, static_cast<long long*>(NULL), out, static_cast<long long*>(NULL),
+										  static_cast<size_t>(1) << 30, static_cast<unsigned int>(0));
+					if (copied > 0)
+					{
+						continue;
+					}
+					if (copied == 0)
+					{
+						return 0;
+					}
+					if (errno == EINTR)
+					{
+						continue;
+					}
+					if ((errno != ENOSYS) && (errno != EXDEV) && (errno != EINVAL) && (errno != EOPNOTSUPP))
+					{
+						return errno;
+					}
+					break;
+				}
+			#endif //#ifdef SYS_copy_file_range
+
+			// sendfile also copies inside the kernel, between any two files.
+			while (use_sendfile)
+			{
+				ssize_t copied = sendfile(out, in, NULL, static_cast<size_t>(1) << 30);
+				if (copied > 0)
+				{
+					continue;
+				}
+				if (copied == 0)
+				{
+					return 0;
+				}
+				if (errno == EINTR)
+				{
+					continue;
+				}
+				if ((errno != ENOSYS) && (errno != EINVAL))
+				{
+					return errno;
+				}
+				use_sendfile = false;
+			}
+		}
+	#else
+		(void)in_info;
+	#endif //#ifdef FS_LINUX_
+
+	std::vector<char> buffer(1024 * 1024);
+	for (;;)
+	{
+		ssize_t bytes = read(in, &buffer[0], buffer.size());
+		if (bytes == 0)
+		{
+			return 0;
+		}
+		if (bytes < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			return errno;
+		}
+		for (ssize_t written=0; written<bytes; )
+		{
+			ssize_t result = write(out, &buffer[written], bytes - written);
+			if (result < 0)
+			{
+				if (errno == EINTR)
+				{
+					continue;
+				}
+				return errno;
+			}
+			written += result;
+		}
+	}
+}
+#endif //#ifdef FS_POSIX_
+
+// Copies the regular file from to to.  Returns 0, or the errno value
+// (GetLastError() on Windows) describing the failure.  A partly written
+// destination is removed.
+inline int try_copy_file(const native_string_t& from, const native_string_t& to, unsigned int options)
+{
+	#ifdef FS_WINDOWS_
+		std::wstring ext_from = from;
+		to_win32_path(ext_from);
+		prepend_extended_fs_indicator(ext_from);
+		std::wstring ext_to = to;
+		to_win32_path(ext_to);
+		prepend_extended_fs_indicator(ext_to);
+
+		// CopyFileEx always copies attributes and times, and clones blocks on
+		// file systems that support it.
+		if (0 == CopyFileExW(ext_from.c_str(), ext_to.c_str(), NULL, NULL, NULL,
+							 ((options & CopyOption::Overwrite) != 0) ? 0 : COPY_FILE_FAIL_IF_EXISTS))
+		{
+			return static_cast<int>(GetLastError());
+		}
+		return 0;
+	#endif //#ifdef FS_WINDOWS_
+	#ifdef FS_POSIX_
+		// O_NONBLOCK keeps the open of a FIFO from waiting for a writer; it is
+		// cleared once the source is known to be a regular file.
+		int in = open(from.c_str(), O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+		if (in == -1)
+		{
+			return errno;
+		}
+		struct stat in_info;
+		if (fstat(in, &in_info) != 0)
+		{
+			int error = errno;
+			close(in);
+			return error;
+		}
+		if (!S_ISREG(in_info.st_mode))
+		{
+			close(in);
+			return S_ISDIR(in_info.st_mode) ? EISDIR : EINVAL;
+		}
+		if (fcntl(in, F_SETFL, fcntl(in, F_GETFL) & ~O_NONBLOCK) != 0)
+		{
+			int error = errno;
+			close(in);
+			return error;
+		}
+
+		int flags = O_WRONLY | O_CREAT | O_CLOEXEC;
+		if ((options & CopyOption::Overwrite) != 0)
+		{
+			// Truncating the source through another name would lose it.
+			struct stat out_info;
+			if ((stat(to.c_str(), &out_info) == 0) &&
+				(out_info.st_dev == in_info.st_dev) && (out_info.st_ino == in_info.st_ino))
+			{
+				close(in);
+				return EINVAL;
+			}
+			flags |= O_TRUNC;
+		}
+		else
+		{
+			flags |= O_EXCL;
+		}
+
+		int out = open(to.c_str(), flags | O_NONBLOCK, in_info.st_mode & 07777);
+		if (out == -1)
+		{
+			int error = errno;
+			close(in);
+			return error;
+		}
+
+		int error = 0;
+		if (fcntl(out, F_SETFL, fcntl(out, F_GETFL) & ~O_NONBLOCK) != 0)
+		{
+			error = errno;
+		}
+		else
+		{
+			error = copy_file_data(in, out, in_info);
+		}
+		if ((error == 0) && ((options & CopyOption::PreserveMetadata) != 0))
+		{
+			struct timespec times[2];
+			#ifdef FS_LINUX_
+				times[0] = in_info.st_atim;
+				times[1] = in_info.st_mtim;
+			#else
+				times[0].tv_sec		= in_info.st_atime;
+				times[0].tv_nsec	= 0;
+				times[1].tv_sec		= in_info.st_mtime;
+				times[1].tv_nsec	= 0;
+			#endif //#ifdef FS_LINUX_
+			if ((fchmod(out, in_info.st_mode & 07777) != 0) ||
+				(futimens(out, times) != 0))
+			{
+				error = errno;
+			}
+		}
+		if ((close(out) != 0) && (error == 0))
+		{
+			error = errno;
+		}
+		close(in);
+
+		if (error != 0)
+		{
+			unlink(to.c_str());
+		}
+		return error;
+	#endif //#ifdef FS_POSIX_
+}
+
+template<class T>
+void copy_file(const T& from, const T& to, unsigned int options)
+{
+	native_string_t nfrom, nto;
+	convert_string(from, nfrom);
+	convert_string(to, nto);
+
+	const int error = try_copy_file(nfrom, nto, options);
+	if (error != 0)
+	{
+		std::string nfrom_path, nto_path;
+		convert_string(from, nfrom_path);
+		convert_string(to, nto_path);
+		#ifdef FS_WINDOWS_
+			SetLastError(static_cast<DWORD>(error));
+		#endif //#ifdef FS_WINDOWS_
+		#ifdef FS_POSIX_
+			errno = error;
+		#endif //#ifdef FS_POSIX_
+		GENERARE_FILESYSTEM_ERROR2(nfrom_path, nto_path);
+	}
+}
+} //namespace internal
+#endif // REGION: copy_file
+
+#if 1 // REGION: exists
+namespace internal
+{
+template<class T>
+bool exists(const T& path)
+{
+	return get_status(path, true).exists();
+}
+} //namespace internal
+#endif // REGION: exists
+
+#if 1 // REGION: work_stealing_pool
+#ifdef FS_CPP11_
+namespace internal
+{
+// Runs a dynamically growing set of tasks on a fixed number of threads.  Each
+// thread owns a deque of tasks: tasks queued by a running task go to the back of
+// its own deque and are taken from the back (depth first), while idle threads
+// steal from the front of other threads' deques.  run() returns once every task,
+// including those queued while running, has completed.  The first exception
+// thrown by a task cancels the tasks not yet started and is rethrown by run().
+class work_stealing_pool
+{
+public:
+	typedef std::function<void(unsigned int worker)> task_t;
+
+private:
+	struct worker_queue
+	{
+		std::mutex			lock;
+		std::deque<task_t>	tasks;
+	};
+
+	std::vector<std::unique_ptr<worker_queue> >	queues;
+	std::atomic<size_t>							pending;	// queued or running
+	std::atomic<size_t>							queued;
+	std::atomic<bool>							cancelled;
+	std::mutex									idle_lock;
+	std::condition_variable						idle_signal;
+	std::mutex									error_lock;
+	std::exception_ptr							error;
+
+	work_stealing_pool(const work_stealing_pool&);
+	work_stealing_pool& operator=(const work_stealing_pool&);
+
+	bool take(unsigned int worker, task_t& task)
+	{
+		{
+			worker_queue& own = *queues[worker];
+			std::lock_guard<std::mutex> guard(own.lock);
+			if (!own.tasks.empty())
+			{
+				task = std::move(own.tasks.back());
+				own.tasks.pop_back();
+				--queued;
+				return true;
+			}
+		}
+		size_t count = queues.size();
+		for (size_t offset=1; offset<count; ++offset)
+		{
+			worker_queue& victim = *queues[(worker + offset) % count];
+			std::lock_guard<std::mutex> guard(victim.lock);
+			if (!victim.tasks.empty())
+			{
+				task = std::move(victim.tasks.front());
+				victim.tasks.pop_front();
+				--queued;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void work(unsigned int worker)
+	{
+		task_t task;
+		for (;;)
+		{
+			if (take(worker, task))
+			{
+				if (!cancelled)
+				{
+					try
+					{
+						task(worker);
+					}
+					catch (...)
+					{
+						std::lock_guard<std::mutex> guard(error_lock);
+						if (!error)
+						{
+							error = std::current_exception();
+						}
+						cancelled = true;
+					}
+				}
+				task = task_t();
+				if (--pending == 0)
+				{
+					std::lock_guard<std::mutex> guard(idle_lock);
+					idle_signal.notify_all();
+				}
+				continue;
+			}
+
+			std::unique_lock<std::mutex> guard(idle_lock);
+			if (pending == 0)
+			{
+				return;
+			}
+			idle_signal.wait(guard, [this]() { return (queued != 0) || (pending == 0); });
+		}
+	}
+
+public:
+	explicit work_stealing_pool(unsigned int thread_count = 0)
+		: pending(0)
+		, queued(0)
+		, cancelled(false)
+	{
+		if (thread_count == 0)
+		{
+			thread_count = std::thread::hardware_concurrency();
+		}
+		if (thread_count == 0)
+		{
+			thread_count = 1;
+		}
+		for (unsigned int i=0; i<thread_count; ++i)
+		{
+			queues.push_back(std::unique_ptr<worker_queue>(new worker_queue));
+		}
+	}
+
+	unsigned int size() const
+	{
+		return static_cast<unsigned int>(queues.size());
+	}
+
+	// Queues a task on the given worker's deque.  Called from within a running
+	// task with that task's worker index, or before run().
+	void push(unsigned int worker, task_t task)
+	{
+		++pending;
+		{
+			worker_queue& own = *queues[worker % queues.size()];
+			std::lock_guard<std::mutex> guard(own.lock);
+			own.tasks.push_back(std::move(task));
+			++queued;
+		}
+		std::lock_guard<std::mutex> guard(idle_lock);
+		idle_signal.notify_one();
+	}
+
+	void run(task_t root)
+	{
+		push(0, std::move(root));
+
+		std::vector<std::thread> threads;
+		for (unsigned int worker=1; worker<size(); ++worker)
+		{
+			threads.push_back(std::thread(&work_stealing_pool::work, this, worker));
+		}
+		work(0);
+		for (size_t i=0; i<threads.size(); ++i)
+		{
+			threads[i].join();
+		}
+
+		cancelled = false;
+		if (error)
+		{
+			std::exception_ptr temp = error;
+			error = std::exception_ptr();
+			std::rethrow_exception(temp);
+		}
+	}
+};
+
+// The most threads worth starting for blocking file system calls, which spend
+// most of their time waiting: a few per core.
+inline unsigned int blocking_thread_limit()
+{
+	return (std::max)(std::thread::hardware_concurrency(), 1u) * 4;
+}
+} //namespace internal
+#endif //#ifdef FS_CPP11_
+#endif // REGION: work_stealing_pool
+
+#if 1 // REGION: io_ring
+#ifdef FS_IO_URING_
+namespace internal
+{
+// A minimal io_uring instance driven through the raw system calls.  One thread
+// at a time queues requests with get_sqe(), hands them to the kernel with
+// submit() and collects results with next_completion().  Callers keep at most
+// capacity() requests in flight, so the completion queue, which the kernel
+// makes twice as large as the submission queue, can't overflow.
+class io_ring
+{
+	int				ring_fd;
+	unsigned char*	sq_map;
+	size_t			sq_map_size;
+	unsigned char*	cq_map;
+	size_t			cq_map_size;
+	io_uring_sqe*	sqes;
+	size_t			sqes_size;
+
+	unsigned*		sq_head;
+	unsigned*		sq_tail;
+	unsigned*		sq_array;
+	unsigned		sq_mask;
+	unsigned		sq_entries;
+	unsigned		sq_local_tail;	// entries queued by get_sqe(), published by submit()
+
+	unsigned*		cq_head;
+	unsigned*		cq_tail;
+	unsigned		cq_mask;
+	io_uring_cqe*	cqes;
+
+	io_ring(const io_ring&);
+	io_ring& operator=(const io_ring&);
+
+	static unsigned char* map_ring(int fd, size_t size, unsigned long long offset)
+	{
+		void* map = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+		return (map == MAP_FAILED) ? 0 : static_cast<unsigned char*>(map);
+	}
+
+	void release()
+	{
+		if (sqes != 0)
+		{
+			munmap(sqes, sqes_size);
+		}
+		if ((cq_map != 0) && (cq_map != sq_map))
+		{
+			munmap(cq_map, cq_map_size);
+		}
+		if (sq_map != 0)
+		{
+			munmap(sq_map, sq_map_size);
+		}
+		if (ring_fd != -1)
+		{
+			close(ring_fd);
+		}
+		ring_fd	= -1;
+		sq_map	= 0;
+		cq_map	= 0;
+		sqes	= 0;
+	}
+
+public:
+	// io_uring may be missing or blocked (ENOSYS, EPERM); check valid().
+	explicit io_ring(unsigned int entries)
+		: ring_fd(-1)
+		, sq_map(0)
+		, sq_map_size(0)
+		, cq_map(0)
+		, cq_map_size(0)
+		, sqes(0)
+		, sqes_size(0)
+		, sq_head(0)
+		, sq_tail(0)
+		, sq_array(0)
+		, sq_mask(0)
+		, sq_entries(0)
+		, sq_local_tail(0)
+		, cq_head(0)
+		, cq_tail(0)
+		, cq_mask(0)
+		, cqes(0)
+	{
+		io_uring_params params;
+		memset(&params, 0, sizeof(params));
+		long fd = syscall(__NR_io_uring_setup, (std::max)(entries, 1u), &params);
+		if (fd < 0)
+		{
+			return;
+		}
+		ring_fd = static_cast<int>(fd);
+
+		sq_map_size = params.sq_off.array + (params.sq_entries * sizeof(unsigned));
+		cq_map_size = params.cq_off.cqes + (params.cq_entries * sizeof(io_uring_cqe));
+		if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0)
+		{
+			sq_map_size = cq_map_size = (std::max)(sq_map_size, cq_map_size);
+		}
+		sq_map = map_ring(ring_fd, sq_map_size, IORING_OFF_SQ_RING);
+		if (sq_map == 0)
+		{
+			release();
+			return;
+		}
+		cq_map = ((params.features & IORING_FEAT_SINGLE_MMAP) != 0) ? sq_map : map_ring(ring_fd, cq_map_size, IORING_OFF_CQ_RING);
+		sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+		sqes = reinterpret_cast<io_uring_sqe*>(map_ring(ring_fd, sqes_size, IORING_OFF_SQES));
+		if ((cq_map == 0) || (sqes == 0))
+		{
+			release();
+			return;
+		}
+
+		sq_head			= reinterpret_cast<unsigned*>(sq_map + params.sq_off.head);
+		sq_tail			= reinterpret_cast<unsigned*>(sq_map + params.sq_off.tail);
+		sq_array		= reinterpret_cast<unsigned*>(sq_map + params.sq_off.array);
+		sq_mask			= *reinterpret_cast<unsigned*>(sq_map + params.sq_off.ring_mask);
+		sq_entries		= params.sq_entries;
+		sq_local_tail	= *sq_tail;
+		cq_head			= reinterpret_cast<unsigned*>(cq_map + params.cq_off.head);
+		cq_tail			= reinterpret_cast<unsigned*>(cq_map + params.cq_off.tail);
+		cq_mask			= *reinterpret_cast<unsigned*>(cq_map + params.cq_off.ring_mask);
+		cqes			= reinterpret_cast<io_uring_cqe*>(cq_map + params.cq_off.cqes);
+	}
+
+	~io_ring()
+	{
+		release();
+	}
+
+	bool valid() const
+	{
+		return ring_fd != -1;
+	}
+
+	unsigned int capacity() const
+	{
+		return sq_entries;
+	}
+
+	// Returns a cleared entry to fill in, or 0 if the submission queue is full.
+	io_uring_sqe* get_sqe()
+	{
+		if (sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries)
+		{
+			return 0;
+		}
+		const unsigned	index	= sq_local_tail & sq_mask;
+		io_uring_sqe*	sqe		= &sqes[index];
+		memset(sqe, 0, sizeof(*sqe));
+		sq_array[index] = index;
+		++sq_local_tail;
+		return sqe;
+	}
+
+	// Hands the queued entries to the kernel, then waits until at least
+	// wait_count completions are ready.  Returns false with errno set on failure.
+	bool submit(unsigned int wait_count)
+	{
+		__atomic_store_n(sq_tail, sq_local_tail, __ATOMIC_RELEASE);
+		for (;;)
+		{
+			const unsigned pending = sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+			if (syscall(__NR_io_uring_enter, ring_fd, pending, wait_count, (wait_count != 0) ? IORING_ENTER_GETEVENTS : 0, NULL, 0) >= 0)
+			{
+				return true;
+			}
+			if (errno != EINTR)
+			{
+				return false;
+			}
+		}
+	}
+
+	// Takes back the entries the kernel hasn't consumed, after submit() failed.
+	// The kernel reads the submission queue only inside submit(), so they
+	// won't be picked up later.
+	void withdraw()
+	{
+		sq_local_tail = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+		__atomic_store_n(sq_tail, sq_local_tail, __ATOMIC_RELEASE);
+	}
+
+	// Same, also reporting the user_data of each entry taken back.
+	void withdraw(std::vector<unsigned long long>& user_data)
+	{
+		for (unsigned i=__atomic_load_n(sq_head, __ATOMIC_ACQUIRE); i!=sq_local_tail; ++i)
+		{
+			user_data.push_back(sqes[sq_array[i & sq_mask]].user_data);
+		}
+		withdraw();
+	}
+
+	// Has the kernel signal the eventfd fd whenever a completion is posted.
+	bool register_eventfd(int fd)
+	{
+		return syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_EVENTFD, &fd, 1) == 0;
+	}
+
+	// Takes the next completion, if one is ready.
+	bool next_completion(unsigned long long& user_data, int& result)
+	{
+		const unsigned head = *cq_head;
+		if (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+		{
+			return false;
+		}
+		const io_uring_cqe& cqe = cqes[head & cq_mask];
+		user_data	= cqe.user_data;
+		result		= cqe.res;
+		__atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+		return true;
+	}
+};
+} //namespace internal
+#endif //#ifdef FS_IO_URING_
+#endif // REGION: io_ring
+
+#if 1 // REGION: batch_status
+namespace internal
+{
+#ifdef FS_IO_URING_
+// Keeps up to queue_depth statx requests in flight.  Returns false, leaving
+// results alone, if no io_uring instance could be created.
+inline bool batch_status_ring(const std::vector<std::string>& paths, bool follow_links, unsigned int queue_depth, std::vector<file_status>& results)
+{
+	io_ring ring(queue_depth);
+	if (!ring.valid())
+	{
+		return false;
+	}
+
+	const unsigned int		depth	= ring.capacity();
+	const unsigned int		mask	= statx_mask(EntryField::All);
+	std::vector<struct statx>	buffers(depth);
+	std::vector<size_t>			slot_path(depth);
+	std::vector<unsigned int>	free_slots;
+	for (unsigned int slot=depth; slot>0; --slot)
+	{
+		free_slots.push_back(slot-1);
+	}
+
+	size_t				next		= 0;
+	size_t				in_flight	= 0;
+	int					error		= 0;
+	size_t				error_index	= 0;
+	bool				ring_failed	= false;
+	std::vector<size_t>	retry;		// paths taken back from the ring after a failed submit
+	while ((!ring_failed && (next < paths.size())) || (in_flight != 0))
+	{
+		while (!ring_failed && (next < paths.size()) && !free_slots.empty())
+		{
+			io_uring_sqe* sqe = ring.get_sqe();
+			if (sqe == 0)
+			{
+				break;
+			}
+			const unsigned int slot = free_slots.back();
+			free_slots.pop_back();
+			slot_path[slot] = next;
+
+			sqe->opcode			= IORING_OP_STATX;
+			sqe->fd				= AT_FDCWD;
+			sqe->addr			= reinterpret_cast<unsigned long long>(paths[next].c_str());
+			sqe->len			= mask;
+			sqe->off			= reinterpret_cast<unsigned long long>(&buffers[slot]);
+			sqe->statx_flags	= follow_links ? 0 : AT_SYMLINK_NOFOLLOW;
+			sqe->user_data		= slot;
+			++next;
+			++in_flight;
+		}
+
+		// The kernel may still be writing into buffers for requests it took, so
+		// when submitting fails the rest are taken back and the loop only waits
+		// for those in flight; the remaining paths are stat'd below.
+		if (!ring.submit(1) && !ring_failed)
+		{
+			std::vector<unsigned long long> withdrawn;
+			ring.withdraw(withdrawn);
+			for (size_t i=0; i<withdrawn.size(); ++i)
+			{
+				const unsigned int slot = static_cast<unsigned int>(withdrawn[i]);
+				retry.push_back(slot_path[slot]);
+				free_slots.push_back(slot);
+				--in_flight;
+			}
+			ring_failed = true;
+		}
+
+		unsigned long long	user_data;
+		int					result;
+		while (ring.next_completion(user_data, result))
+		{
+			const unsigned int	slot	= static_cast<unsigned int>(user_data);
+			const size_t		index	= slot_path[slot];
+			free_slots.push_back(slot);
+			--in_flight;
+
+			if (result == 0)
+			{
+				results[index] = status_from_statx(buffers[slot]);
+				continue;
+			}
+			if (result == -EINVAL)
+			{
+				// The kernel predates IORING_OP_STATX.
+				if (stat_at(AT_FDCWD, paths[index].c_str(), follow_links, EntryField::All, results[index]))
+				{
+					continue;
+				}
+				result = -errno;
+			}
+			if ((result != -ENOENT) && (result != -ENOTDIR) && (error == 0))
+			{
+				error		= -result;
+				error_index	= index;
+			}
+		}
+	}
+
+	for (; next<paths.size(); ++next)
+	{
+		retry.push_back(next);
+	}
+	for (size_t i=0; i<retry.size(); ++i)
+	{
+		const size_t index = retry[i];
+		if (!stat_at(AT_FDCWD, paths[index].c_str(), follow_links, EntryField::All, results[index]) &&
+			(errno != ENOENT) && (errno != ENOTDIR) && (error == 0))
+		{
+			error		= errno;
+			error_index	= index;
+		}
+	}
+
+	if (error != 0)
+	{
+		errno = error;
+		GENERARE_FILESYSTEM_ERROR1(paths[error_index]);
+	}
+	return true;
+}
+#endif //#ifdef FS_IO_URING_
+
+// Stats paths[first, last) one after the other.
+inline void batch_status_range(const std::vector<native_string_t>& paths, size_t first, size_t last, bool follow_links, std::vector<file_status>& results)
+{
+	for (size_t index=first; index<last; ++index)
+	{
+		results[index] = get_status(paths[index], follow_links);
+	}
+}
+
+// Fills results[i] with the status of paths[i].  See filesystem::batch_status.
+inline void batch_status(const std::vector<native_string_t>& paths, bool follow_links, unsigned int queue_depth, std::vector<file_status>& results)
+{
+	results.assign(paths.size(), file_status());
+	if (paths.empty())
+	{
+		return;
+	}
+
+	#ifdef FS_IO_URING_
+		if (batch_status_ring(paths, follow_links, queue_depth, results))
+		{
+			return;
+		}
+	#endif //#ifdef FS_IO_URING_
+
+	#ifdef FS_CPP11_
+		// Blocking stats on as many threads as requests would be in flight,
+		// within a few per core.
+		const size_t	chunk_size		= 64;
+		const size_t	chunk_count		= (paths.size() + chunk_size - 1) / chunk_size;
+		const size_t	thread_count	= (std::min)(static_cast<size_t>((std::min)((std::max)(queue_depth, 1u), blocking_thread_limit())), chunk_count);
+		if (thread_count > 1)
+		{
+			work_stealing_pool pool(static_cast<unsigned int>(thread_count));
+			pool.run([&](unsigned int worker)
+			{
+				for (size_t chunk=0; chunk<chunk_count; ++chunk)
+				{
+					const size_t first = chunk * chunk_size;
+					pool.push(worker, [&paths, &results, first, chunk_size, follow_links](unsigned int)
+					{
+						batch_status_range(paths, first, (std::min)(first + chunk_size, paths.size()), follow_links, results);
+					});
+				}
+			});
+			return;
+		}
+	#endif //#ifdef FS_CPP11_
+
+	batch_status_range(paths, 0, paths.size(), follow_links, results);
+}
+} //namespace internal
+#endif // REGION: batch_status
+
+#if 1 // REGION: Win32 Junction Points
+#ifdef FS_WINDOWS_
+namespace internal
+{
+template<class T>
+bool create_junction_point(T link, T source);
+
+template<>
+bool create_junction_point(std::wstring link, std::wstring source)
+{
+	if (link.empty() || source.empty())
+	{
+		return false;
+	}
+
+	to_win32_path(link);
+	prepend_extended_fs_indicator(link);
+
+	remove_extended_fs_indicator(source);
+	to_win32_path(source);
+	std::wstring(L"\\??\\").append(source).swap(source);
+
+	char raw_reparse_buffer[MAXIMUM_REPARSE_DATA_BUFFER_SIZE] = { 0 };
+	TMN_REPARSE_DATA_BUFFER& reparse_buffer = *reinterpret_cast<TMN_REPARSE_DATA_BUFFER*>(raw_reparse_buffer);
+
+	const WORD nDestMountPointBytes = static_cast<WORD>(source.size()) * 2;
+
+	reparse_buffer.ReparseTag           = IO_REPARSE_TAG_MOUNT_POINT;
+	reparse_buffer.ReparseDataLength    = nDestMountPointBytes + 12;
+	reparse_buffer.Reserved             = 0;
+	reparse_buffer.SubstituteNameOffset = 0;
+	reparse_buffer.SubstituteNameLength = nDestMountPointBytes;
+	reparse_buffer.PrintNameOffset      = nDestMountPointBytes + 2;
+	reparse_buffer.PrintNameLength      = 0;
+	lstrcpyW(reparse_buffer.PathBuffer, source.c_str());
+
+	HANDLE dirHandle = 
+			CreateFile(	link.c_str(),
+						GENERIC_READ | GENERIC_WRITE,
+						0,
+						0,
+						OPEN_EXISTING,
+						FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OPEN_REPARSE_POINT,
+						0);
+	if (dirHandle == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	DWORD dummy;
+	return (0 !=
+		DeviceIoControl(dirHandle,
+						FSCTL_SET_REPARSE_POINT,
+						(LPVOID)&reparse_buffer,
+						reparse_buffer.ReparseDataLength + TMN_REPARSE_DATA_BUFFER_HEADER_SIZE,
+						NULL,
+						0,
+						&dummy,
+						0));
+}
+
+template<>
+bool create_junction_point(std::string link, std::string source)
+{
+	std::wstring wlink, wsource;
+	to_wide_string(link, wlink);
+	to_wide_string(source, wsource);
+	return create_junction_point(wlink, wsource);
+}
+
+template<class T>
+bool is_junction_point(const T&);
+
+template<>
+bool is_junction_point(const std::wstring& path)
+{
+	std::wstring ext_path = path;
+	to_win32_path(ext_path);
+	prepend_extended_fs_indicator(ext_path);
+
+	DWORD result = GetFileAttributesW(ext_path.c_str());
+	return ((result != INVALID_FILE_ATTRIBUTES) &&
+			((result & (FILE_ATTRIBUTE_DIRECTORY | FILE_ATTRIBUTE_REPARSE_POINT)) == (FILE_ATTRIBUTE_DIRECTORY | FILE_ATTRIBUTE_REPARSE_POINT)));
+}
+
+template<>
+bool is_junction_point(const std::string& path)
+{
+	std::wstring wpath;
+	to_wide_string(path, wpath);
+	return is_junction_point(wpath);
+}
+}
+#endif //#ifdef FS_WINDOWS_
+#endif // REGION: Win32 Junction Points
+
+#if 1 // REGION: remove_all
+namespace internal
+{
+#ifdef FS_WINDOWS_
+// Removes everything below dir and returns the number of entries removed.
+// Junction points are removed without descending into them.
+inline size_t remove_directory_contents(const std::wstring& dir)
+{
+	size_t						count = 0;
+	std::vector<std::wstring>	names;
+
+	scan_directory(dir, std::wstring(), names, false);
+	for (size_t i=0; i<names.size(); ++i)
+	{
+		remove_file(dir + L"/" + names[i]);
+		++count;
+	}
+
+	scan_directory(dir, std::wstring(), names, true);
+	for (size_t i=0; i<names.size(); ++i)
+	{
+		const std::wstring subdir = dir + L"/" + names[i];
+		if (!is_junction_point(subdir))
+		{
+			count += remove_directory_contents(subdir);
+		}
+		remove_directory(subdir);
+		++count;
+	}
+	return count;
+}
+
+template<class T>
+size_t remove_all(const T& path, unsigned int thread_count);
+
+template<>
+inline size_t remove_all(const std::wstring& path, unsigned int /*thread_count*/)
+{
+	const file_status status = get_status(path, false);
+	if (!status.exists())
+	{
+		return 0;
+	}
+	if (!status.is_directory())
+	{
+		remove_file(path);
+		return 1;
+	}
+	size_t count = is_junction_point(path) ? 0 : remove_directory_contents(path);
+	remove_directory(path);
+	return count + 1;
+}
+
+template<>
+inline size_t remove_all(const std::string& path, unsigned int thread_count)
+{
+	std::wstring wpath;
+	to_wide_string(path, wpath);
+	return remove_all(wpath, thread_count);
+}
+#endif //#ifdef FS_WINDOWS_
+#ifdef FS_POSIX_
+// Removes every entry of dir that isn't a directory, and collects the names
+// of its subdirectories.  Symbolic links are removed, never followed.
+// Returns the number of entries removed.
+inline size_t remove_directory_files(const directory_handle& dir, std::vector<std::string>& subdirs)
+{
+	int		dir_fd	= dir.reopen();
+	DIR*	entries	= fdopendir(dir_fd);
+	if (entries == NULL)
+	{
+		int error = errno;
+		close(dir_fd);
+		errno = error;
+		GENERARE_FILESYSTEM_ERROR0();
+	}
+
+	size_t			count = 0;
+	struct dirent*	ent;
+	while ((ent = readdir(entries)) != NULL)
+	{
+		if (is_dot_or_dot_dot(ent->d_name))
+			continue;
+
+		bool is_dir = false;
+		#ifdef DT_UNKNOWN
+			if (ent->d_type != DT_UNKNOWN)
+			{
+				is_dir = (ent->d_type == DT_DIR);
+			}
+			else
+		#endif //#ifdef DT_UNKNOWN
+		{
+			struct stat info;
+			is_dir = dir.stat(ent->d_name, info, false) && S_ISDIR(info.st_mode);
+		}
+
+		if (is_dir)
+		{
+			subdirs.push_back(ent->d_name);
+		}
+		else if (unlinkat(dir.native_handle(), ent->d_name, 0) == 0)
+		{
+			++count;
+		}
+		else if (errno != ENOENT)
+		{
+			int error = errno;
+			std::string name(ent->d_name);
+			closedir(entries);
+			errno = error;
+			GENERARE_FILESYSTEM_ERROR1(name);
+		}
+	}
+	closedir(entries);
+	return count;
+}
+
+// Removes everything below path, opening each directory by its full path and
+// closing it again before descending.  Used below max_handle_depth.
+inline size_t remove_directory_contents(const std::string& path)
+{
+	std::vector<std::string>	subdirs;
+	size_t						count;
+	{
+		directory_handle dir(path, false);
+		count = remove_directory_files(dir, subdirs);
+	}
+	for (size_t i=0; i<subdirs.size(); ++i)
+	{
+		const std::string subdir = path + "/" + subdirs[i];
+		count += remove_directory_contents(subdir);
+		if (rmdir(subdir.c_str()) != 0)
+		{
+			GENERARE_FILESYSTEM_ERROR1(subdir);
+		}
+		++count;
+	}
+	return count;
+}
+
+// Removes everything below dir, found at path, one directory at a time.
+inline size_t remove_directory_contents(const directory_handle& dir, const std::string& path, size_t depth)
+{
+	std::vector<std::string>	subdirs;
+	size_t						count = remove_directory_files(dir, subdirs);
+	for (size_t i=0; i<subdirs.size(); ++i)
+	{
+		if (depth < max_handle_depth)
+		{
+			directory_handle subdir(dir, subdirs[i].c_str(), false);
+			count += remove_directory_contents(subdir, path + "/" + subdirs[i], depth + 1);
+		}
+		else
+		{
+			count += remove_directory_contents(path + "/" + subdirs[i]);
+		}
+		dir.remove_directory(subdirs[i].c_str());
+		++count;
+	}
+	return count;
+}
+
+#ifdef FS_CPP11_
+// Removes a tree with one task per directory on a work_stealing_pool.  Each
+// directory counts the tasks still working below it; the task that brings the
+// count to zero removes the directory and reports to its parent, so
+// directories are removed after their contents without any task waiting.
+class parallel_remover
+{
+	// Directories down to max_handle_depth keep their handle open until
+	// their subdirectories are removed, which are opened and removed through
+	// it.  Deeper ones are opened by path and closed once scanned.
+	struct node
+	{
+		std::shared_ptr<node>				parent;
+		std::unique_ptr<directory_handle>	dir;
+		std::string							name;
+		std::string							path;
+		size_t								depth;
+		std::atomic<size_t>					pending;	// subdirectories not yet removed, plus one for the scan
+	};
+
+	work_stealing_pool	pool;
+	std::atomic<size_t>	removed;
+
+	// Releases one pending count of n, removing directories whose count drops
+	// to zero.  The root directory is left for the caller.
+	void release(std::shared_ptr<node> n)
+	{
+		while (n && (--n->pending == 0))
+		{
+			n->dir.reset();
+			if (n->parent)
+			{
+				if (n->parent->depth < max_handle_depth)
+				{
+					n->parent->dir->remove_directory(n->name.c_str());
+				}
+				else if (rmdir(n->path.c_str()) != 0)
+				{
+					GENERARE_FILESYSTEM_ERROR1(n->path);
+				}
+				++removed;
+			}
+			n = n->parent;
+		}
+	}
+
+	void process(unsigned int worker, const std::shared_ptr<node>& n)
+	{
+		if (!n->dir)
+		{
+			n->dir.reset((n->parent->depth < max_handle_depth) ? new directory_handle(*n->parent->dir, n->name.c_str(), false)
+															   : new directory_handle(n->path, false));
+		}
+
+		std::vector<std::string> subdirs;
+		removed += remove_directory_files(*n->dir, subdirs);
+		if (n->depth >= max_handle_depth)
+		{
+			n->dir.reset();
+		}
+
+		n->pending = subdirs.size() + 1;
+		for (size_t i=0; i<subdirs.size(); ++i)
+		{
+			std::shared_ptr<node> child(new node);
+			child->parent	= n;
+			child->name		= subdirs[i];
+			child->path		= n->path + "/" + subdirs[i];
+			child->depth	= n->depth + 1;
+			pool.push(worker, [this, child](unsigned int w)
+			{
+				process(w, child);
+			});
+		}
+		release(n);
+	}
+
+public:
+	explicit parallel_remover(unsigned int thread_count)
+		: pool(thread_count)
+		, removed(0)
+	{
+	}
+
+	size_t remove_contents(const std::string& path)
+	{
+		std::shared_ptr<node> root(new node);
+		root->dir.reset(new directory_handle(path));
+		root->path	= path;
+		root->depth	= 0;
+		pool.run([this, root](unsigned int worker)
+		{
+			process(worker, root);
+		});
+		return removed;
+	}
+};
+#endif //#ifdef FS_CPP11_
+
+template<class T>
+size_t remove_all(const T& path, unsigned int thread_count);
+
+template<>
+inline size_t remove_all(const std::string& path, unsigned int thread_count)
+{
+	struct stat info;
+	if (lstat(path.c_str(), &info) != 0)
+	{
+		if (errno == ENOENT)
+		{
+			return 0;
+		}
+		GENERARE_FILESYSTEM_ERROR1(path);
+	}
+	if (!S_ISDIR(info.st_mode))
+	{
+		if (unlink(path.c_str()) != 0)
+		{
+			GENERARE_FILESYSTEM_ERROR1(path);
+		}
+		return 1;
+	}
+
+	size_t count = 0;
+	#ifdef FS_CPP11_
+		if (thread_count != 1)
+		{
+			parallel_remover remover(thread_count);
+			count = remover.remove_contents(path);
+		}
+		else
+	#else
+		(void)thread_count;
+	#endif //#ifdef FS_CPP11_
+	{
+		directory_handle dir(path);
+		count = remove_directory_contents(dir, path, 0);
+	}
+
+	if (rmdir(path.c_str()) != 0)
+	{
+		GENERARE_FILESYSTEM_ERROR1(path);
+	}
+	return count + 1;
+}
+
+template<>
+inline size_t remove_all(const std::wstring& path, unsigned int thread_count)
+{
+	std::string npath;
+	to_narrow_string(path, npath);
+	return remove_all(npath, thread_count);
+}
+#endif //#ifdef FS_POSIX_
+} //namespace internal
+#endif // REGION: remove_all
+
+#if 1 // REGION: class basic_directory_range
+
+struct DirectoryFilter
+{
+	enum Enum
+	{
+		Files,
+		Subdirectories,
+	};
+};
+
+template<class T>
+class basic_path;
+
+template<class T>
+class basic_directory_entry;
+
+// Single-pass range over the entries of a directory.  Entries are read from the
+// operating system one at a time as the iterator is advanced, so the first entry
+// is available immediately and memory use does not grow with the directory size.
+//
+//	filesystem::directory_range logs(dir, filesystem::DirectoryFilter::Files, "*.log");
+//	for (filesystem::directory_range::iterator it=logs.begin(); it!=logs.end(); ++it)
+//		...
+template<class T>
+class basic_directory_range
+{
+public:
+	typedef T						char_t;
+	typedef std::basic_string<T>	string_t;
+
+	class iterator
+	{
+		basic_directory_range* range;
+
+	public:
+		typedef std::input_iterator_tag	iterator_category;
+		typedef string_t				value_type;
+		typedef std::ptrdiff_t			difference_type;
+		typedef const string_t*			pointer;
+		typedef const string_t&			reference;
+
+		iterator()
+			: range(0)
+		{
+		}
+
+		explicit iterator(basic_directory_range* range_)
+			: range(range_->at_end ? 0 : range_)
+		{
+		}
+
+		reference operator*() const
+		{
+			return range->current;
+		}
+
+		pointer operator->() const
+		{
+			return &range->current;
+		}
+
+		iterator& operator++()
+		{
+			range->advance();
+			if (range->at_end)
+			{
+				range = 0;
+			}
+			return *this;
+		}
+
+		iterator operator++(int)
+		{
+			iterator temp(*this);
+			++(*this);
+			return temp;
+		}
+
+		bool operator==(const iterator& other) const
+		{
+			return (range == other.range);
+		}
+
+		bool operator!=(const iterator& other) const
+		{
+			return (range != other.range);
+		}
+	};
+
+private:
+	internal::directory_scanner	scanner;
+	string_t					current;
+	bool						at_end;
+
+	basic_directory_range(const basic_directory_range&);
+	basic_directory_range& operator=(const basic_directory_range&);
+
+	static internal::native_string_t to_native(const string_t& in)
+	{
+		internal::native_string_t result;
+		internal::convert_string(in, result);
+		return result;
+	}
+
+	void advance()
+	{
+		if (scanner.next())
+		{
+			internal::convert_string(scanner.name(), current);
+		}
+		else
+		{
+			at_end = true;
+		}
+	}
+
+public:
+	// buffer_size is the largest number of bytes of directory entries read from
+	// the operating system at a time, where the platform supports it.
+	basic_directory_range(const basic_path<T>& dir, DirectoryFilter::Enum filter = DirectoryFilter::Files, const basic_compiled_glob<T>& pattern = basic_compiled_glob<T>(), size_t buffer_size = internal::directory_scanner::default_buffer_size)
+		: scanner(to_native(dir.to_portable_string()), internal::to_native_pattern(pattern), filter == DirectoryFilter::Subdirectories, buffer_size)
+		, at_end(false)
+	{
+		advance();
+	}
+
+	// A plain string pattern matches with the platform's file name case rules.
+	basic_directory_range(const basic_path<T>& dir, DirectoryFilter::Enum filter, const string_t& pattern, size_t buffer_size = internal::directory_scanner::default_buffer_size)
+		: scanner(to_native(dir.to_portable_string()), internal::to_native_pattern(pattern), filter == DirectoryFilter::Subdirectories, buffer_size)
+		, at_end(false)
+	{
+		advance();
+	}
+
+	basic_directory_range(const basic_path<T>& dir, DirectoryFilter::Enum filter, const char_t* pattern, size_t buffer_size = internal::directory_scanner::default_buffer_size)
+		: scanner(to_native(dir.to_portable_string()), internal::to_native_pattern(string_t(pattern)), filter == DirectoryFilter::Subdirectories, buffer_size)
+		, at_end(false)
+	{
+		advance();
+	}
+
+	iterator begin()
+	{
+		return iterator(this);
+	}
+
+	iterator end()
+	{
+		return iterator();
+	}
+
+	bool empty() const
+	{
+		return at_end;
+	}
+
+	// Describes the entry the range is positioned on.  fields is a mask of
+	// EntryField values; filled receives those that were set.
+	file_status status(unsigned int fields, unsigned int& filled) const
+	{
+		return scanner.status(fields, filled);
+	}
+};
+#endif // REGION: class basic_directory_range
+
+#if 1 // REGION: path element storage
+
+// A read-only view of one element of a basic_path.  It refers to the path's
+// own storage and is invalidated when the path is modified or destroyed.
+template<class T>
+class basic_element_view
+{
+	const T*	first;
+	size_t		length;
+
+public:
+	typedef T						char_t;
+	typedef std::basic_string<T>	string_t;
+	typedef const T*				const_iterator;
+
+	basic_element_view()
+		: first(0)
+		, length(0)
+	{
+	}
+
+	basic_element_view(const T* first_, size_t length_)
+		: first(first_)
+		, length(length_)
+	{
+	}
+
+	const T* data() const
+	{
+		return first;
+	}
+
+	size_t size() const
+	{
+		return length;
+	}
+
+	bool empty() const
+	{
+		return (length == 0);
+	}
+
+	const_iterator begin() const
+	{
+		return first;
+	}
+
+	const_iterator end() const
+	{
+		return first + length;
+	}
+
+	T operator[](size_t index) const
+	{
+		return first[index];
+	}
+
+	string_t str() const
+	{
+		return string_t(first, length);
+	}
+
+	bool operator==(const basic_element_view& other) const
+	{
+		return internal::compare_path_element(first, length, other.first, other.length);
+	}
+
+	bool operator!=(const basic_element_view& other) const
+	{
+		return !operator==(other);
+	}
+};
+
+namespace internal
+{
+// Begin offset and length of each element of a path within its path string.
+// Tables of up to inline_capacity elements are kept inside the object, so most
+// paths need no allocation besides the path string itself.
+class element_table
+{
+public:
+	struct element
+	{
+		unsigned int	begin;
+		unsigned int	length;
+	};
+
+	enum
+	{
+		inline_capacity = 6,
+	};
+
+private:
+	element					inline_elems[inline_capacity];
+	std::vector<element>	heap_elems;	// holds every element once inline storage is exceeded
+	size_t					count;
+
+	element* data()
+	{
+		return heap_elems.empty() ? inline_elems : &heap_elems[0];
+	}
+
+	const element* data() const
+	{
+		return heap_elems.empty() ? inline_elems : &heap_elems[0];
+	}
+
+public:
+	element_table()
+		: count(0)
+	{
+	}
+
+#ifdef FS_CPP11_
+	element_table(const element_table& other) = default;
+	element_table& operator=(const element_table& other) = default;
+
+	// A moved-from table is left empty.
+	element_table(element_table&& other) noexcept
+		: count(0)
+	{
+		swap(other);
+	}
+
+	element_table& operator=(element_table&& other) noexcept
+	{
+		if (this != &other)
+		{
+			clear();
+			swap(other);
+		}
+		return *this;
+	}
+#endif //#ifdef FS_CPP11_
+
+	size_t size() const
+	{
+		return count;
+	}
+
+	bool empty() const
+	{
+		return (count == 0);
+	}
+
+	const element& operator[](size_t index) const
+	{
+		return data()[index];
+	}
+
+	element& operator[](size_t index)
+	{
+		return data()[index];
+	}
+
+	const element& back() const
+	{
+		return data()[count-1];
+	}
+
+	void push_back(size_t begin, size_t length)
+	{
+		element e;
+		e.begin		= static_cast<unsigned int>(begin);
+		e.length	= static_cast<unsigned int>(length);
+		if (!heap_elems.empty())
+		{
+			heap_elems.push_back(e);
+		}
+		else if (count < inline_capacity)
+		{
+			inline_elems[count] = e;
+		}
+		else
+		{
+			heap_elems.reserve(2 * inline_capacity);
+			heap_elems.assign(inline_elems, inline_elems + inline_capacity);
+			heap_elems.push_back(e);
+		}
+		++count;
+	}
+
+	// Removes elements [first, last).
+	void erase(size_t first, size_t last)
+	{
+		element* elems = data();
+		std::copy(elems + last, elems + count, elems + first);
+		count -= (last - first);
+		if (!heap_elems.empty())
+		{
+			heap_elems.resize(count);
+			if (count == 0)
+			{
+				std::vector<element>().swap(heap_elems);
+			}
+		}
+	}
+
+	void clear()
+	{
+		count = 0;
+		std::vector<element>().swap(heap_elems);
+	}
+
+	void swap(element_table& other)
+	{
+		std::swap_ranges(inline_elems, inline_elems + inline_capacity, other.inline_elems);
+		heap_elems.swap(other.heap_elems);
+		std::swap(count, other.count);
+	}
+};
+} //namespace internal
+#endif // REGION: path element storage
+
+#if 1 // REGION: class basic_path
+
+struct Initializer
+{
+	enum Enum
+	{
+		CurrentWorkingDirectory,
+	};
+};
+
+template<class T>
+class basic_path
+{
+public:
+	typedef T						char_t;
+	typedef std::basic_string<T>	string_t;
+	typedef std::vector<string_t>	vecstr_t;
+	typedef basic_element_view<T>	element_view_t;
+
+private:
+	typedef internal::element_table	element_table_t;
+
+	// The path is stored as its portable path string.  The elements are
+	// substrings of it, located through an offset table.
+	string_t			path_string;
+	element_table_t		path_elems;
+	bool				relative;
+	bool				drive_specified;
+	bool				unc_path;
+	unsigned long long	path_hash;		// hash of the elements, kept up to date by every change
+
+	static bool element_equals(const char_t* elem, size_t length, const char_t* literal)
+	{
+		size_t pos = 0;
+		for (; (pos < length) && (literal[pos] != 0); ++pos)
+		{
+			if (elem[pos] != literal[pos])
+			{
+				return false;
+			}
+		}
+		return (pos == length) && (literal[pos] == 0);
+	}
+
+	static size_t find_in_element(const char_t* elem, size_t length, char_t c, size_t from = 0)
+	{
+		for (size_t pos=from; pos<length; ++pos)
+		{
+			if (elem[pos] == c)
+			{
+				return pos;
+			}
+		}
+		return string_t::npos;
+	}
+
+	// Parses path_, which is consumed: its buffer may become the path string.
+	void initialize(string_t& path_)
+	{
+		#ifdef FS_WINDOWS_
+			internal::remove_extended_fs_indicator(path_);
+		#endif //#ifdef FS_WINDOWS_
+
+		if (path_.empty())
+		{
+			throw filesystem_error("Path cannot be initialized to empty value", __FILE__, __LINE__, "", "");
+		}
+
+		typename string_t::iterator it	 = path_.begin();
+		typename string_t::iterator itEnd = path_.end();
+		for (; it!=itEnd; ++it)
+		{
+			if (*it == '\\')
+			{
+				*it = '/';
+			}
+		}
+
+		if (path_.find(string_t(2, '/').c_str(), 1) != string_t::npos) // find "//"
+		{
+			throw filesystem_error("Path encountered unexpected neighboring directory separators: '//'", __FILE__, __LINE__, "", "");
+		}
+		if ((path_.find(string_t(3, '.').c_str()) == 0) &&
+			(path_.find_first_not_of('.') == string_t::npos)) // find repeats of elipses more than 2 in length
+		{
+			throw filesystem_error("Invalid path specified", __FILE__, __LINE__, "", "");
+		}
+
+		// Elements are first located within path_, then copied into path_string.
+		element_table_t	elems;
+		size_t			searchIndex = 0;
+		size_t			nextDelimiter = 0;
+
+		// Detect non-relative and/or drive-specified paths
+		if (path_[0] == '/')
+		{
+			relative = false;
+			if (path_.length() == 1)
+			{
+				// our path is "/".  We can short-cut and return.
+				path_string.swap(path_);
+				path_elems.push_back(0, 1);
+				update_hash();
+				return;
+			}
+			if (path_[1] == '/')
+			{
+				// we have a UNC path
+				unc_path = true;
+				nextDelimiter = path_.find('/', 2);
+				if (nextDelimiter == string_t::npos)
+				{
+					// we only have the root path.  We can short-cut and return.
+					path_elems.push_back(0, path_.length());
+					path_string.swap(path_);
+					update_hash();
+					return;
+				}
+				elems.push_back(0, nextDelimiter);
+				searchIndex = nextDelimiter + 1;
+			}
+			else
+			{
+				// we have a non-UNC root path.  Just set the first element to "/"
+				elems.push_back(0, 1);
+				searchIndex = 1;
+			}
+		}
+		else
+		{
+			if ((path_.length() >= 2) &&
+				(path_[1] == ':') &&
+				(
+				 ((path_[0] >= 'A') && (path_[0] <= 'Z')) ||
+				 ((path_[0] >= 'a') && (path_[0] <= 'z'))
+				)
+			   )
+			{
+				// we have a drive specification.
+				drive_specified = true;
+
+				if ((path_.length() >= 3) &&
+					(path_[2] == '/'))
+				{
+					relative = false;
+					elems.push_back(0, 3);
+					searchIndex = 3;
+				}
+				else
+				{
+					elems.push_back(0, 2);
+					searchIndex = 2;
+				}
+			}
+		}
+
+		// Now parse the remainding part of the path string.
+		if (searchIndex != string_t::npos)
+		{
+			for (;;)
+			{
+				nextDelimiter = path_.find('/', searchIndex);
+				if (nextDelimiter == string_t::npos)
+				{
+					if (searchIndex < path_.length())
+					{
+						elems.push_back(searchIndex, path_.length()-searchIndex);
+					}
+					break;
+				}
+				elems.push_back(searchIndex, nextDelimiter-searchIndex);
+				searchIndex = nextDelimiter+1;
+			}
+		}
+
+		// Path cleanup & final validity checks
+		const char_t* source = path_.c_str();
+
+		// Validate environment variable members.  Ex: "$(PATH)"
+		for (size_t elem=0; elem<elems.size(); ++elem)
+		{
+			validate_element(source + elems[elem].begin, elems[elem].length);
+		}
+
+		// Remove "."
+		{
+			size_t kept = 0;
+			for (size_t elem=0; elem<elems.size(); ++elem)
+			{
+				if (!element_equals(source + elems[elem].begin, elems[elem].length, dot()))
+				{
+					elems[kept++] = elems[elem];
+				}
+			}
+			elems.erase(kept, elems.size());
+		}
+
+		// Remove "..".
+		remove_double_elipses(source, elems);
+
+		assign_elements(path_, elems);
+	}
+
+	static void validate_element(const char_t* e, size_t length)
+	{
+		size_t dollarSignLocation = find_in_element(e, length, '$');
+		if (dollarSignLocation != string_t::npos)
+		{
+			if ((dollarSignLocation != 0) ||								// '(' is not where we expect it.
+				(length < 4) ||												// element is too short.  It can't hold "$(A)".
+				(find_in_element(e, length, '$', 1) != string_t::npos) ||	// There's too many dollar signs.
+				(find_in_element(e, length, '(') != 1) ||					// '(' is not where we expect it.
+				(find_in_element(e, length, '(', 2) != string_t::npos) ||	// There's too many open parentheses.
+				(find_in_element(e, length, ')') != length-1))				// ')' is not where we expect it.
+			{
+				throw filesystem_error("Path element contains '$', but has invalid environment variable format", __FILE__, __LINE__, "", "");
+			}
+			// Everything is OK if we reach here.
+		}
+		else if ((find_in_element(e, length, '(') != string_t::npos) ||
+				 (find_in_element(e, length, '(') != string_t::npos))
+		{
+			throw filesystem_error("Path element contains parentheses, but has invalid environment variable format", __FILE__, __LINE__, "", "");
+		}
+	}
+
+	// Appends relative path elements to this (already normalized) path.  Only
+	// the appended part is parsed and validated; "." elements are dropped and
+	// ".." elements cancel the preceding element where possible, exactly as if
+	// the joined string had been parsed from scratch.
+	void append_elements(const string_t& other)
+	{
+		string_t part(other);
+		typename string_t::iterator it		= part.begin();
+		typename string_t::iterator itEnd	= part.end();
+		for (; it!=itEnd; ++it)
+		{
+			if (*it == '\\')
+			{
+				*it = '/';
+			}
+		}
+
+		if ((!part.empty() && (part[0] == '/')) ||
+			(part.find(string_t(2, '/').c_str()) != string_t::npos)) // find "//", including the separator we join with
+		{
+			throw filesystem_error("Path encountered unexpected neighboring directory separators: '//'", __FILE__, __LINE__, "", "");
+		}
+
+		// Locate and validate every new element before modifying this path.
+		element_table_t	elems;
+		size_t			searchIndex = 0;
+		while (searchIndex < part.length())
+		{
+			size_t nextDelimiter = part.find('/', searchIndex);
+			if (nextDelimiter == string_t::npos)
+			{
+				nextDelimiter = part.length();
+			}
+			elems.push_back(searchIndex, nextDelimiter-searchIndex);
+			searchIndex = nextDelimiter+1;
+		}
+
+		const char_t* source = part.c_str();
+		for (size_t elem=0; elem<elems.size(); ++elem)
+		{
+			validate_element(source + elems[elem].begin, elems[elem].length);
+		}
+
+		for (size_t elem=0; elem<elems.size(); ++elem)
+		{
+			const char_t*	e		= source + elems[elem].begin;
+			const size_t	length	= elems[elem].length;
+
+			if (element_equals(e, length, dot()))
+			{
+				continue;
+			}
+			if (is_current_directory())
+			{
+				path_string.clear();
+				path_elems.clear();
+				path_hash = internal::path_hash_seed;
+			}
+			if (element_equals(e, length, double_elipses()) && can_remove_last_element())
+			{
+				remove_last_element();
+			}
+			else
+			{
+				push_element(e, length);
+			}
+		}
+
+		if (path_elems.empty())
+		{
+			push_element(dot(), 1);
+		}
+	}
+
+	// True for the "." placeholder used when a relative path has no elements.
+	bool is_current_directory() const
+	{
+		return relative && (path_elems.size() == 1) && element_equals(element_data(0), element_length(0), dot());
+	}
+
+	// The first element of an absolute, drive-specified or UNC path is its root.
+	size_t first_removable_element() const
+	{
+		return (drive_specified || unc_path || (!relative)) ? 1 : 0;
+	}
+
+	// A trailing ".." cancels the last element unless that element is a root,
+	// another "..", or an environment variable.
+	bool can_remove_last_element() const
+	{
+		const size_t count = path_elems.size();
+		if (count <= first_removable_element())
+		{
+			return false;
+		}
+		const char_t*	last		= element_data(count-1);
+		const size_t	last_length	= element_length(count-1);
+		return !element_equals(last, last_length, double_elipses()) && (last[0] != '$');
+	}
+
+	void remove_last_element()
+	{
+		const size_t count = path_elems.size();
+		path_string.resize((count == 1) ? 0 : (path_elems[count-2].begin + path_elems[count-2].length));
+		path_elems.erase(count-1, count);
+		update_hash();
+	}
+
+	void push_element(const char_t* e, size_t length)
+	{
+		const size_t element = path_elems.size();
+		// Elements are separated by '/', except after a root element such as "c:/" or "/".
+		if ((element > 1) ||
+			((element == 1) && (unc_path || relative)))
+		{
+			path_string.push_back('/');
+		}
+		path_elems.push_back(path_string.size(), length);
+		path_string.append(e, length);
+		path_hash = internal::hash_path_element(path_hash, e, length);
+	}
+
+	void update_hash()
+	{
+		path_hash = internal::path_hash_seed;
+		for (size_t elem=0; elem<path_elems.size(); ++elem)
+		{
+			path_hash = internal::hash_path_element(path_hash, element_data(elem), element_length(elem));
+		}
+	}
+
+	static const char_t* dot()
+	{
+		static const char_t literal[] = { '.', 0 };
+		return literal;
+	}
+
+	static const char_t* double_elipses()
+	{
+		static const char_t literal[] = { '.', '.', 0 };
+		return literal;
+	}
+
+	// Collapses "<elem>/.." pairs in a single pass, treating the kept elements as
+	// a stack: a ".." removes the last kept element unless that element is a
+	// root, another "..", or an environment variable, in which case the ".." is
+	// kept.  This gives the same result as repeatedly removing the first such
+	// pair.
+	void remove_double_elipses(const char_t* source, element_table_t& elems) const
+	{
+		const size_t	first_removable	= (drive_specified || unc_path || (!relative)) ? 1 : 0;
+		size_t			kept			= 0;
+
+		for (size_t elem=0; elem<elems.size(); ++elem)
+		{
+			if ((kept > first_removable) &&
+				element_equals(source + elems[elem].begin, elems[elem].length, double_elipses()))
+			{
+				const char_t* prev = source + elems[kept-1].begin;
+				if (!element_equals(prev, elems[kept-1].length, double_elipses()) &&
+					(prev[0] != '$'))
+				{
+					--kept;
+					continue;
+				}
+			}
+			elems[kept++] = elems[elem];
+		}
+		elems.erase(kept, elems.size());
+	}
+
+	// Builds path_string and path_elems from elements located in source.  When
+	// the normalized path is laid out exactly like source, the source buffer
+	// is taken over instead of being copied.
+	void assign_elements(string_t& source, const element_table_t& elems)
+	{
+		size_t	elementCount = elems.size();
+		if (elementCount == 0)
+		{
+			path_string.assign(1, '.'); // The path was something like "." or "././." indicating the current path.  We need to keep this.
+			path_elems.clear();
+			path_elems.push_back(0, 1);
+			update_hash();
+			return;
+		}
+
+		// Elements are separated by '/', except after a root element such as "c:/" or "/".
+		size_t	length		= 0;
+		bool	same_layout	= true;
+		for (size_t element=0; element<elementCount; ++element)
+		{
+			if ((element > 1) ||
+				((element == 1) && (unc_path || relative)))
+			{
+				++length;
+			}
+			same_layout = same_layout && (elems[element].begin == length);
+			length += elems[element].length;
+		}
+
+		if (same_layout && (length == source.size()))
+		{
+			path_string.swap(source);
+			element_table_t new_elems(elems);
+			path_elems.swap(new_elems);
+			update_hash();
+			return;
+		}
+
+		string_t		new_string;
+		element_table_t	new_elems;
+		new_string.reserve(length);
+		for (size_t element=0; element<elementCount; ++element)
+		{
+			if ((element > 1) ||
+				((element == 1) && (unc_path || relative)))
+			{
+				new_string.push_back('/');
+			}
+			new_elems.push_back(new_string.size(), elems[element].length);
+			new_string.append(source.c_str() + elems[element].begin, elems[element].length);
+		}
+
+		path_string.swap(new_string);
+		path_elems.swap(new_elems);
+		update_hash();
+	}
+
+	const string_t& get_path_string() const
+	{
+		return path_string;
+	}
+
+	const char_t* element_data(size_t index) const
+	{
+		return path_string.c_str() + path_elems[index].begin;
+	}
+
+	size_t element_length(size_t index) const
+	{
+		return path_elems[index].length;
+	}
+
+	string_t element_string(size_t index) const
+	{
+		return string_t(element_data(index), element_length(index));
+	}
+
+	bool compare_element(size_t index, const basic_path& other, size_t other_index) const
+	{
+		return internal::compare_path_element(element_data(index), element_length(index),
+											  other.element_data(other_index), other.element_length(other_index));
+	}
+
+	void directory_get_entries(DirectoryFilter::Enum filter, const string_t& pattern, std::vector<basic_directory_entry<T> >& results, unsigned int fields)
+	{
+		basic_path fullpath = full_path();
+		if (!fullpath.is_directory())
+		{
+			throw filesystem_error("Specified path is not a directory.", __FILE__, __LINE__, "", "");
+		}
+		results.clear();
+
+		basic_directory_range<T>					range(fullpath, filter, pattern);
+		typename basic_directory_range<T>::iterator	it		= range.begin();
+		typename basic_directory_range<T>::iterator	itEnd	= range.end();
+		for (; it!=itEnd; ++it)
+		{
+			basic_path		entry_path(fullpath);
+			unsigned int	filled = 0;
+			entry_path /= *it;
+			const file_status status = range.status(fields, filled);
+			results.push_back(basic_directory_entry<T>(entry_path, status, filled));
+		}
+	}
+
+	bool get_variable_id(const string_t& elem, string_t& varId) const
+	{
+		// assert(!elem.empty());
+		if (elem[0] == '$')
+		{
+			size_t elemSize = elem.size();
+			if ((elem[1] != '(') || (elem[elemSize-1] != ')'))
+			{
+				assert(false);  // we shouldn't get here.
+				throw filesystem_error("Assertion failure", __FILE__, __LINE__, "", "");
+			}
+			varId = elem.substr(2, elemSize-3);
+			return true;
+		}
+		return false;
+	}
+
+#ifdef FS_POSIX_
+	// Scans dir, then its subdirectories after the scanners are closed, so
+	// each level keeps only its own handle open.
+	static void directory_scan_subdirs_for_files_helper(const internal::directory_handle& dir, const basic_path& dir_path, const internal::native_pattern_t& pattern, std::vector<basic_path>& results, size_t depth)
+	{
+		std::vector<internal::native_string_t> subdir_names;
+		directory_scan_files_and_subdirs(dir, dir_path, pattern, results, subdir_names);
+
+		string_t name;
+		for (size_t i=0; i<subdir_names.size(); ++i)
+		{
+			internal::convert_string(subdir_names[i], name);
+			if (depth < internal::max_handle_depth)
+			{
+				internal::directory_handle subdir(dir, subdir_names[i].c_str());
+				directory_scan_subdirs_for_files_helper(subdir, dir_path / name, pattern, results, depth + 1);
+			}
+			else
+			{
+				directory_scan_subdirs_for_files_by_path(dir_path / name, pattern, results);
+			}
+		}
+	}
+
+	// Below internal::max_handle_depth each directory is opened by its full
+	// path and closed again before its subdirectories are scanned.
+	static void directory_scan_subdirs_for_files_by_path(const basic_path& dir_path, const internal::native_pattern_t& pattern, std::vector<basic_path>& results)
+	{
+		std::vector<internal::native_string_t> subdir_names;
+		{
+			internal::native_string_t ndir;
+			internal::convert_string(dir_path.to_portable_string(), ndir);
+			internal::directory_handle dir(ndir);
+			directory_scan_files_and_subdirs(dir, dir_path, pattern, results, subdir_names);
+		}
+
+		string_t name;
+		for (size_t i=0; i<subdir_names.size(); ++i)
+		{
+			internal::convert_string(subdir_names[i], name);
+			directory_scan_subdirs_for_files_by_path(dir_path / name, pattern, results);
+		}
+	}
+
+	static void directory_scan_files_and_subdirs(const internal::directory_handle& dir, const basic_path& dir_path, const internal::native_pattern_t& pattern, std::vector<basic_path>& results, std::vector<internal::native_string_t>& subdir_names)
+	{
+		string_t name;
+		{
+			internal::directory_scanner files(dir, pattern, false);
+			while (files.next())
+			{
+				internal::convert_string(files.name(), name);
+				results.push_back(dir_path);
+				results.back() /= name;
+			}
+		}
+
+		internal::directory_scanner subdirs(dir, internal::native_pattern_t(), true);
+		while (subdirs.next())
+		{
+			subdir_names.push_back(subdirs.name());
+		}
+	}
+#endif //#ifdef FS_POSIX_
+#ifdef FS_WINDOWS_
+	void directory_scan_subdirs_for_files_helper(const string_t& pattern, std::vector<basic_path>& results)
+	{
+		std::vector<basic_path> dir_results;
+		directory_get_files(pattern, dir_results);
+		
+		results.insert(results.end(), dir_results.begin(), dir_results.end());
+		
+		directory_get_subdirs(dir_results);
+
+		typename std::vector<basic_path>::iterator it		= dir_results.begin();
+		typename std::vector<basic_path>::iterator itEnd	= dir_results.end();
+		for (; it!=itEnd; ++it)
+		{
+			it->directory_scan_subdirs_for_files_helper(pattern, results);
+		}
+	}
+#endif //#ifdef FS_WINDOWS_
+
+#ifdef FS_CPP11_
+	struct parallel_scan_state
+	{
+		internal::work_stealing_pool			pool;
+		internal::native_pattern_t				pattern;
+		std::vector<std::vector<basic_path> >	results; // one list per worker
+
+		parallel_scan_state(unsigned int thread_count, const string_t& pattern_)
+			: pool(thread_count)
+			, pattern(internal::to_native_pattern(pattern_))
+			, results(pool.size())
+		{
+		}
+	};
+
+#ifdef FS_POSIX_
+	typedef std::shared_ptr<internal::directory_handle> shared_dir_t;
+
+	static void parallel_scan_task(parallel_scan_state& state, unsigned int worker, const shared_dir_t& dir, const basic_path& dir_path, size_t depth)
+	{
+		std::vector<basic_path>&	results = state.results[worker];
+		string_t					name;
+		{
+			internal::directory_scanner files(*dir, state.pattern, false);
+			while (files.next())
+			{
+				internal::convert_string(files.name(), name);
+				results.push_back(dir_path);
+				results.back() /= name;
+			}
+		}
+
+		// Subdirectories are opened by the task that scans them, so a queued
+		// task holds only a reference to its parent's handle.  Past
+		// internal::max_handle_depth queued tasks hold only the path, so the
+		// open handles stay bounded however deep the tree is.
+		internal::directory_scanner subdirs(*dir, internal::native_pattern_t(), true);
+		while (subdirs.next())
+		{
+			internal::convert_string(subdirs.name(), name);
+			basic_path					subdir_path = dir_path / name;
+			internal::native_string_t	subdir_name = subdirs.name();
+			parallel_scan_state*		pstate		= &state;
+			if (depth < internal::max_handle_depth)
+			{
+				state.pool.push(worker, [pstate, dir, subdir_name, subdir_path, depth](unsigned int w)
+				{
+					shared_dir_t subdir(new internal::directory_handle(*dir, subdir_name.c_str()));
+					parallel_scan_task(*pstate, w, subdir, subdir_path, depth + 1);
+				});
+			}
+			else
+			{
+				state.pool.push(worker, [pstate, subdir_path, depth](unsigned int w)
+				{
+					internal::native_string_t ndir;
+					internal::convert_string(subdir_path.to_portable_string(), ndir);
+					shared_dir_t subdir(new internal::directory_handle(ndir));
+					parallel_scan_task(*pstate, w, subdir, subdir_path, depth + 1);
+				});
+			}
+		}
+	}
+#endif //#ifdef FS_POSIX_
+#ifdef FS_WINDOWS_
+	static void parallel_scan_task(parallel_scan_state& state, unsigned int worker, const basic_path& dir_path)
+	{
+		std::vector<basic_path>&	results = state.results[worker];
+		string_t					name;
+		internal::native_string_t	ndir;
+		internal::convert_string(dir_path.to_portable_string(), ndir);
+		{
+			internal::directory_scanner files(ndir, state.pattern, false);
+			while (files.next())
+			{
+				internal::convert_string(files.name(), name);
+				results.push_back(dir_path);
+				results.back() /= name;
+			}
+		}
+
+		internal::directory_scanner subdirs(ndir, internal::native_pattern_t(), true);
+		while (subdirs.next())
+		{
+			internal::convert_string(subdirs.name(), name);
+			basic_path				subdir_path = dir_path / name;
+			parallel_scan_state*	pstate		= &state;
+			state.pool.push(worker, [pstate, subdir_path](unsigned int w)
+			{
+				parallel_scan_task(*pstate, w, subdir_path);
+			});
+		}
+	}
+#endif //#ifdef FS_WINDOWS_
+#endif //#ifdef FS_CPP11_
+
+	struct Adopt
+	{
+	};
+
+	// Builds a path from a string the caller no longer needs.
+	basic_path(string_t& path_, Adopt)
+		: relative(true)
+		, drive_specified(false)
+		, unc_path(false)
+		, path_hash(internal::path_hash_seed)
+	{
+		initialize(path_);
+	}
+
+public:
+	basic_path(const string_t& path_)
+		: relative(true)
+		, drive_specified(false)
+		, unc_path(false)
+		, path_hash(internal::path_hash_seed)
+	{
+		string_t temp(path_);
+		initialize(temp);
+	}
+
+	basic_path(const char_t* path_)
+		: relative(true)
+		, drive_specified(false)
+		, unc_path(false)
+		, path_hash(internal::path_hash_seed)
+	{
+		string_t temp(path_);
+		initialize(temp);
+	}
+
+#ifdef FS_CPP11_
+	basic_path(string_t&& path_)
+		: relative(true)
+		, drive_specified(false)
+		, unc_path(false)
+		, path_hash(internal::path_hash_seed)
+	{
+		initialize(path_);
+	}
+
+	basic_path(const basic_path& other) = default;
+	basic_path& operator=(const basic_path& other) = default;
+
+	// A moved-from path is left as a valid empty path.
+	basic_path(basic_path&& other) noexcept
+		: relative(true)
+		, drive_specified(false)
+		, unc_path(false)
+		, path_hash(internal::path_hash_seed)
+	{
+		swap(other);
+	}
+
+	basic_path& operator=(basic_path&& other) noexcept
+	{
+		if (this != &other)
+		{
+			swap(other);
+			other.path_string.clear();
+			other.path_elems.clear();
+			other.relative			= true;
+			other.drive_specified	= false;
+			other.unc_path			= false;
+			other.path_hash			= internal::path_hash_seed;
+		}
+		return *this;
+	}
+#endif //#ifdef FS_CPP11_
+
+	basic_path(Initializer::Enum initializer)
+		: relative(true)
+		, drive_specified(false)
+		, unc_path(false)
+		, path_hash(internal::path_hash_seed)
+	{
+		switch (initializer)
+		{
+			case Initializer::CurrentWorkingDirectory:
+			{
+				string_t path;
+				internal::current_working_dir(path);
+				initialize(path);
+				break;
+			}
+			default:
+			{
+				throw filesystem_error("Invalid path initializer specified", __FILE__, __LINE__, "", "");
+			}
+		}
+	}
+
+	basic_path& operator=(const string_t& path_string)
+	{
+		basic_path newPath(path_string);
+		swap(newPath);
+		return *this;
+	}
+
+#ifdef FS_CPP11_
+	basic_path& operator=(string_t&& path_string)
+	{
+		basic_path newPath(path_string, Adopt());
+		swap(newPath);
+		return *this;
+	}
+#endif //#ifdef FS_CPP11_
+
+	basic_path& operator=(Initializer::Enum initializer)
+	{
+		basic_path newPath(initializer);
+		swap(newPath);
+		return *this;
+	}
+
+	void swap(basic_path& other)
+	{
+		path_elems.swap(other.path_elems);
+		path_string.swap(other.path_string);
+
+		std::swap(relative,				other.relative);
+		std::swap(drive_specified,		other.drive_specified);
+		std::swap(unc_path,				other.unc_path);
+		std::swap(path_hash,			other.path_hash);
+	}
+
+	basic_path operator/(const string_t& other) const FS_LVALUE_REF_
+	{
+		basic_path newPath(*this);
+		newPath.append_elements(other);
+		return newPath;
+	}
+
+	basic_path operator/(const basic_path& other) const FS_LVALUE_REF_
+	{
+		return operator/(other.get_path_string());
+	}
+
+	// A literal converts equally well to string_t and to basic_path.
+	basic_path operator/(const char_t* other) const FS_LVALUE_REF_
+	{
+		return operator/(string_t(other));
+	}
+
+#ifdef FS_CPP11_
+	// Appends to a path that is about to be discarded, reusing its storage:
+	//	std::move(dir) / "child"
+	basic_path operator/(const string_t& other) &&
+	{
+		append_elements(other);
+		return std::move(*this);
+	}
+
+	basic_path operator/(const basic_path& other) &&
+	{
+		append_elements(other.get_path_string());
+		return std::move(*this);
+	}
+
+	basic_path operator/(const char_t* other) &&
+	{
+		append_elements(string_t(other));
+		return std::move(*this);
+	}
+#endif //#ifdef FS_CPP11_
+
+	basic_path& operator/=(const string_t& other)
+	{
+		append_elements(other); // validates before modifying, so *this is unchanged on error
+		return *this;
+	}
+
+	basic_path& operator/=(const basic_path& other)
+	{
+		return operator/=(other.get_path_string());
+	}
+
+	basic_path& operator/=(const char_t* other)
+	{
+		return operator/=(string_t(other));
+	}
+
+	basic_path& append(const string_t& other)
+	{
+		return (*this)/= other;
+	}
+
+	basic_path& append(const basic_path& other)
+	{
+		return (*this)/= other;
+	}
+
+	bool is_relative() const
+	{
+		return relative;
+	}
+
+	bool is_drive_specified() const
+	{
+		return drive_specified;
+	}
+
+	bool is_unc_path() const
+	{
+		return unc_path;
+	}
+
+	bool exists() const
+	{
+		return internal::exists(get_path_string());
+	}
+
+	// Follows symbolic links.  Call once and query the result instead of calling
+	// exists(), is_file() and is_directory() one after the other.
+	file_status status() const
+	{
+		return internal::get_status(get_path_string(), true);
+	}
+
+	// Reports a symbolic link itself rather than its target.
+	file_status symlink_status() const
+	{
+		return internal::get_status(get_path_string(), false);
+	}
+
+	bool is_file() const
+	{
+		return internal::is_file(get_path_string());
+	}
+
+	bool is_directory() const
+	{
+		return internal::is_directory(get_path_string());
+	}
+
+	bool is_directory_empty() const
+	{
+		return internal::is_directory_empty(get_path_string());
+	}
+
+	const string_t to_portable_string() const
+	{
+		return get_path_string();
+	}
+
+	string_t to_win32_string() const
+	{
+		string_t					win23_str	= get_path_string();
+		typename string_t::iterator it			= win23_str.begin();
+		typename string_t::iterator itEnd		= win23_str.end();
+		for (; it!=itEnd; ++it)
+		{
+			if (*it == '/')
+			{
+				*it = '\\';
+			}
+		}
+		return win23_str;
+	}
+
+	basic_path full_path() const
+	{
+		string_t temp_path_string;
+
+		#ifdef FS_WINDOWS_
+			if (drive_specified & relative)
+			{
+				temp_path_string = internal::cur_drive_path(element_string(0));
+				size_t elements = element_count();
+				if (elements > 0)
+				{
+					size_t lastIndex = temp_path_string.length() - 1;
+					if ((temp_path_string[lastIndex] != '/') &&
+						(temp_path_string[lastIndex] != '\\'))
+					{
+						temp_path_string.push_back('/');
+					}
+
+					temp_path_string.append(element_data(1), element_length(1));
+					for (size_t elem=2; elem<elements; ++elem)
+					{
+						temp_path_string.push_back('/');
+						temp_path_string.append(element_data(elem), element_length(elem));
+					}
+				}
+			}
+			else
+		#endif //#ifdef FS_WINDOWS_
+			{
+				temp_path_string = to_portable_string();
+			}
+		string_t full_path_string = internal::full_pathname(temp_path_string);
+		return basic_path(full_path_string, Adopt());
+	}
+
+	basic_path from(const basic_path& other) const
+	{
+		basic_path thisFullPath = full_path();
+		basic_path otherFullPath = other.full_path();
+
+		if (!thisFullPath.compare_element(0, otherFullPath, 0))
+		{
+			//we have paths with different roots.  Return the other full path.
+			return thisFullPath;
+		}
+		// We have similar paths, we can reach one path from the other.
+		size_t thisPathElems		= thisFullPath.element_count();
+		size_t otherPathElems		= otherFullPath.element_count();
+		size_t maxSimilarElems		= (thisPathElems < otherPathElems) ? thisPathElems : otherPathElems;
+		size_t differentElemIndex	= maxSimilarElems+1;
+		for (size_t elem=1; elem<maxSimilarElems; ++elem)
+		{
+			if (!thisFullPath.compare_element(elem, otherFullPath, elem))
+			{
+				differentElemIndex = elem;
+				break;
+			}
+		}
+
+		string_t newPathString;
+		for (size_t elem=differentElemIndex; elem<otherPathElems; ++elem)
+		{
+			newPathString.push_back('.');
+			newPathString.push_back('.');
+			newPathString.push_back('/');
+		}
+		for (size_t elem=differentElemIndex; elem<thisPathElems; ++elem)
+		{
+			newPathString.append(thisFullPath.element_data(elem), thisFullPath.element_length(elem));
+			newPathString.push_back('/');
+		}
+		//newPathString.erase(newPathString.end()-1);
+		return basic_path(newPathString, Adopt());
+	}
+
+	basic_path from(const string_t& other) const
+	{
+		return from(basic_path(other));
+	}
+
+	basic_path to(const basic_path& other) const
+	{
+		return other.from(*this);
+	}
+
+	basic_path to(const string_t& other) const
+	{
+		return basic_path(other).from(*this);
+	}
+
+	basic_path apply_variables(const std::map<string_t, string_t>& varmap) const
+	{
+		typename std::map<string_t, string_t>::const_iterator it;
+
+		size_t		elemCount = element_count();
+		size_t		elem = 0;
+		string_t	newPathString;
+		string_t	varId;
+
+		if (!relative)
+		{
+			newPathString = element_string(0);
+		}
+		else
+		{
+			if (get_variable_id(element_string(0), varId) &&
+				((it = varmap.find(varId)) != varmap.end()))
+			{
+				newPathString = it->second;
+				char_t lastChar = *(newPathString.end()-1);
+				if ((lastChar != '/') && (lastChar != '\\'))
+				{
+					newPathString.push_back('/');
+				}
+			}
+			else
+			{
+				newPathString = element_string(0);
+				newPathString.push_back('/');
+			}
+		}
+
+		for (elem=1; elem<elemCount; ++elem)
+		{
+			if (get_variable_id(element_string(elem), varId) &&
+				((it = varmap.find(varId)) != varmap.end()))
+			{
+				newPathString.append(it->second);
+				char_t lastChar = *(newPathString.end()-1);
+				if ((lastChar != '/') && (lastChar != '\\'))
+				{
+					newPathString.push_back('/');
+				}
+			}
+			else
+			{
+				newPathString.append(element_data(elem), element_length(elem));
+				newPathString.push_back('/');
+			}
+		}
+
+		return basic_path(newPathString, Adopt());
+	}
+
+	bool operator==(const basic_path& other) const
+	{
+		// Equal paths have equal hashes, element counts and string lengths.
+		size_t elems = element_count();
+		if ((path_hash != other.path_hash) ||
+			(elems != other.element_count()) ||
+			(path_string.size() != other.path_string.size()))
+		{
+			return false;
+		}
+		for (size_t elem=0; elem<elems; ++elem)
+		{
+			if (!compare_element(elem, other, elem))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool operator!=(const basic_path& other) const
+	{
+		return !operator==(other);
+	}
+
+	// Orders paths element by element, consistently with operator==.
+	bool operator<(const basic_path& other) const
+	{
+		const size_t elems = std::min(element_count(), other.element_count());
+		for (size_t elem=0; elem<elems; ++elem)
+		{
+			const int order = internal::order_path_element(element_data(elem), element_length(elem),
+														   other.element_data(elem), other.element_length(elem));
+			if (order != 0)
+			{
+				return (order < 0);
+			}
+		}
+		return (element_count() < other.element_count());
+	}
+
+	bool operator>(const basic_path& other) const
+	{
+		return other.operator<(*this);
+	}
+
+	bool operator<=(const basic_path& other) const
+	{
+		return !other.operator<(*this);
+	}
+
+	bool operator>=(const basic_path& other) const
+	{
+		return !operator<(other);
+	}
+
+	// Hash consistent with operator==.  It is maintained as the path changes,
+	// so this does not touch the path string.
+	size_t hash() const
+	{
+		return static_cast<size_t>(path_hash ^ (path_hash >> 32));
+	}
+
+	size_t element_count() const
+	{
+		return path_elems.size();
+	}
+
+	element_view_t element(size_t index) const
+	{
+		return element_view_t(element_data(index), element_length(index));
+	}
+
+	string_t filename() const
+	{
+		return element_string(element_count()-1);
+	}
+
+	string_t stem() const
+	{
+		string_t temp = filename();
+		return temp.substr(0, temp.find_last_of('.'));
+	}
+
+	string_t extension() const
+	{
+		string_t temp = filename();
+		return temp.substr(temp.find_last_of('.')+1);
+	}
+
+	void directory_get_files(std::vector<string_t>& results)
+	{
+		if (!this->is_directory())
+		{
+			throw filesystem_error("Specified path is not a directory.", __FILE__, __LINE__, "", "");
+		}
+		internal::dir_get_files(to_portable_string(), string_t(), results);
+	}
+
+	void directory_get_files(const string_t& pattern, std::vector<string_t>& results)
+	{
+		if (!this->is_directory())
+		{
+			throw filesystem_error("Specified path is not a directory.", __FILE__, __LINE__, "", "");
+		}
+		internal::dir_get_files(to_portable_string(), pattern, results);
+	}
+
+	void directory_get_files(const string_t& pattern, std::vector<basic_path>& results)
+	{
+		basic_path fullpath = full_path(); 
+		if (!fullpath.is_directory())
+		{
+			throw filesystem_error("Specified path is not a directory.", __FILE__, __LINE__, "", "");
+		}
+		results.clear();
+
+		basic_directory_range<T>					range(fullpath, DirectoryFilter::Files, pattern);
+		typename basic_directory_range<T>::iterator	it		= range.begin();
+		typename basic_directory_range<T>::iterator	itEnd	= range.end();
+		for (; it!=itEnd; ++it)
+		{
+			results.push_back(fullpath);
+			results.back() /= *it;
+		}
+	}
+
+	void directory_get_files(std::vector<basic_path>& results)
+	{
+		directory_get_files(string_t(), results);
+	}
+
+	// Like directory_get_files, but each result also carries the metadata
+	// selected by fields (a mask of EntryField values).
+	void directory_get_files(const string_t& pattern, std::vector<basic_directory_entry<T> >& results, unsigned int fields = EntryField::Basic)
+	{
+		directory_get_entries(DirectoryFilter::Files, pattern, results, fields);
+	}
+
+	// Scans the directory once for all patterns.  results[i] receives the names
+	// of the files matching patterns.pattern(i).
+	void directory_get_files(const basic_glob_set<T>& patterns, std::vector<std::vector<string_t> >& results)
+	{
+		if (!this->is_directory())
+		{
+			throw filesystem_error("Specified path is not a directory.", __FILE__, __LINE__, "", "");
+		}
+		internal::scan_directory(to_portable_string(), patterns, results, false);
+	}
+
+	void directory_get_subdirs(std::vector<string_t>& results)
+	{
+		if (!this->is_directory())
+		{
+			throw filesystem_error("Specified path is not a directory.", __FILE__, __LINE__, "", "");
+		}
+		internal::dir_get_subdirs(to_portable_string(), string_t(), results);
+	}
+
+	void directory_get_subdirs(const string_t& pattern, std::vector<string_t>& results)
+	{
+		if (!this->is_directory())
+		{
+			throw filesystem_error("Specified path is not a directory.", __FILE__, __LINE__, "", "");
+		}
+		internal::dir_get_subdirs(to_portable_string(), pattern, results);
+	}
+
+	void directory_get_subdirs(const string_t& pattern, std::vector<basic_path>& results)
+	{
+		basic_path fullpath = full_path(); 
+		if (!fullpath.is_directory())
+		{
+			throw filesystem_error("Specified path is not a directory.", __FILE__, __LINE__, "", "");
+		}
+		results.clear();
+
+		basic_directory_range<T>					range(fullpath, DirectoryFilter::Subdirectories, pattern);
+		typename basic_directory_range<T>::iterator	it		= range.begin();
+		typename basic_directory_range<T>::iterator	itEnd	= range.end();
+		for (; it!=itEnd; ++it)
+		{
+			results.push_back(fullpath);
+			results.back() /= *it;
+		}
+	}
+
+	void directory_get_subdirs(std::vector<basic_path>& results)
+	{
+		directory_get_subdirs(string_t(), results);
+	}
+
+	void directory_get_subdirs(const string_t& pattern, std::vector<basic_directory_entry<T> >& results, unsigned int fields = EntryField::Basic)
+	{
+		directory_get_entries(DirectoryFilter::Subdirectories, pattern, results, fields);
+	}
+
+	void directory_get_subdirs(const basic_glob_set<T>& patterns, std::vector<std::vector<string_t> >& results)
+	{
+		if (!this->is_directory())
+		{
+			throw filesystem_error("Specified path is not a directory.", __FILE__, __LINE__, "", "");
+		}
+		internal::scan_directory(to_portable_string(), patterns, results, true);
+	}
+
+	void directory_scan_subdirs_for_files(const string_t& pattern, std::vector<basic_path>& results)
+	{
+		results.clear();
+		#ifdef FS_POSIX_
+			// Descend through directory handles so each subdirectory is opened
+			// relative to its parent instead of by its full path.
+			basic_path					fullpath = full_path();
+			internal::native_string_t ndir;
+			internal::convert_string(fullpath.to_portable_string(), ndir);
+
+			internal::directory_handle dir(ndir);
+			directory_scan_subdirs_for_files_helper(dir, fullpath, internal::to_native_pattern(pattern), results, 0);
+		#endif //#ifdef FS_POSIX_
+		#ifdef FS_WINDOWS_
+			directory_scan_subdirs_for_files_helper(pattern, results);
+		#endif //#ifdef FS_WINDOWS_
+	}
+
+	void directory_scan_subdirs_for_files(std::vector<basic_path>& results)
+	{
+		directory_scan_subdirs_for_files(string_t(), results);
+	}
+
+	// Parses and normalizes a list of path strings.  results[i] corresponds to
+	// paths[i]; an invalid path throws filesystem_error.
+	static void normalize(const std::vector<string_t>& paths, std::vector<basic_path>& results)
+	{
+		results.clear();
+		results.reserve(paths.size());
+
+		typename std::vector<string_t>::const_iterator it		= paths.begin();
+		typename std::vector<string_t>::const_iterator itEnd	= paths.end();
+		for (; it!=itEnd; ++it)
+		{
+			results.push_back(basic_path(*it));
+		}
+	}
+
+	// As above, but produces the normalized portable strings.
+	static void normalize(const std::vector<string_t>& paths, std::vector<string_t>& results)
+	{
+		results.clear();
+		results.resize(paths.size());
+
+		for (size_t index=0; index<paths.size(); ++index)
+		{
+			basic_path normalized(paths[index]);
+			results[index].swap(normalized.path_string);
+		}
+	}
+
+#ifdef FS_CPP11_
+	// Same as directory_scan_subdirs_for_files, but each directory is scanned as a
+	// separate task on a pool of thread_count threads (0 selects the number of
+	// hardware threads).  Results are in no particular order unless sorted is
+	// set, in which case they are sorted by path string.
+	void directory_scan_subdirs_for_files_parallel(const string_t& pattern, std::vector<basic_path>& results, unsigned int thread_count = 0, bool sorted = false)
+	{
+		results.clear();
+
+		basic_path			fullpath = full_path();
+		parallel_scan_state	state(thread_count, pattern);
+		parallel_scan_state* pstate = &state;
+
+		#ifdef FS_POSIX_
+			string_t ndir_string = fullpath.to_portable_string();
+			state.pool.run([pstate, &fullpath, &ndir_string](unsigned int worker)
+			{
+				internal::native_string_t ndir;
+				internal::convert_string(ndir_string, ndir);
+				shared_dir_t dir(new internal::directory_handle(ndir));
+				parallel_scan_task(*pstate, worker, dir, fullpath, 0);
+			});
+		#endif //#ifdef FS_POSIX_
+		#ifdef FS_WINDOWS_
+			state.pool.run([pstate, &fullpath](unsigned int worker)
+			{
+				parallel_scan_task(*pstate, worker, fullpath);
+			});
+		#endif //#ifdef FS_WINDOWS_
+
+		size_t total = 0;
+		for (size_t worker=0; worker<state.results.size(); ++worker)
+		{
+			total += state.results[worker].size();
+		}
+		results.reserve(total);
+		for (size_t worker=0; worker<state.results.size(); ++worker)
+		{
+			std::vector<basic_path>& worker_results = state.results[worker];
+			results.insert(results.end(), worker_results.begin(), worker_results.end());
+			std::vector<basic_path>().swap(worker_results);
+		}
+
+		if (sorted)
+		{
+			std::sort(results.begin(), results.end(), [](const basic_path& lhs, const basic_path& rhs)
+			{
+				return lhs.get_path_string() < rhs.get_path_string();
+			});
+		}
+	}
+
+	void directory_scan_subdirs_for_files_parallel(std::vector<basic_path>& results, unsigned int thread_count = 0, bool sorted = false)
+	{
+		directory_scan_subdirs_for_files_parallel(string_t(), results, thread_count, sorted);
+	}
+#endif //#ifdef FS_CPP11_
+
+#ifdef FS_WINDOWS_
+	bool is_junction_point() const
+	{
+		return internal::is_junction_point(get_path_string());
+	}
+#endif //#ifdef FS_WINDOWS_
+};
+#endif // REGION: class basic_path
+
+#if 1 // REGION: class basic_directory_entry
+// A path found by a directory scan, with the metadata gathered by the scan.
+// Only the fields in fields() are filled in; the others are zero.
+template<class T>
+class basic_directory_entry
+{
+	basic_path<T>	entry_path;
+	file_status		entry_status;
+	unsigned int	entry_fields;
+
+public:
+	basic_directory_entry(const basic_path<T>& path_, const file_status& status_, unsigned int fields_)
+		: entry_path(path_)
+		, entry_status(status_)
+		, entry_fields(fields_)
+	{
+	}
+
+	const basic_path<T>& path() const
+	{ return entry_path;}
+
+	const file_status& status() const
+	{ return entry_status;}
+
+	// EntryField values that were filled in.
+	unsigned int fields() const
+	{ return entry_fields;}
+
+	bool has(EntryField::Enum field) const
+	{ return (entry_fields & field) == static_cast<unsigned int>(field);}
+};
+
+typedef basic_directory_entry<char>		directory_entry;
+typedef basic_directory_entry<wchar_t>	wdirectory_entry;
+#endif // REGION: class basic_directory_entry
+
+#if 1 // REGION: class basic_path_interner
+#ifdef FS_CPP11_
+// Maps paths to compact integer ids.  Each id stores only the id of its parent
+// and its last element, so paths that share a prefix share its storage, and two
+// ids from the same interner are equal exactly when their paths are equal.
+// Every member may be called from several threads at once: interning locks one
+// of shard_count shards, chosen by hashing the parent id and element, while
+// looking up an id's parent or element takes no lock.
+template<class T>
+class basic_path_interner
+{
+public:
+	typedef T						char_t;
+	typedef std::basic_string<T>	string_t;
+	typedef basic_path<T>			path_t;
+	typedef basic_element_view<T>	element_view_t;
+	typedef unsigned int			id_t;
+
+	// The parent of root elements.  Never returned by intern().
+	static const id_t none = 0;
+
+private:
+	static const unsigned int	shard_bits			= 6;
+	static const unsigned int	shard_count			= 1u << shard_bits;
+	static const size_t			max_shard_nodes		= (size_t(1) << (32 - shard_bits)) - 1;
+	static const size_t			first_segment_size	= 64;		// segment k holds first_segment_size << k nodes
+	static const size_t			segment_count		= 32;
+	static const size_t			text_block_size		= 16384;	// characters
+
+	struct node
+	{
+		const T*		data;
+		unsigned int	length;
+		id_t			parent;
+	};
+
+	struct slot
+	{
+		id_t			id;
+		unsigned int	hash;
+	};
+
+	// Nodes live in segments that never move once allocated, so they can be
+	// read without the shard lock.  Element text is copied into blocks owned
+	// by the shard.
+	struct shard
+	{
+		std::mutex							lock;
+		std::atomic<node*>					segments[segment_count];
+		size_t								node_count;
+		std::vector<slot>					slots;		// open addressing, linear probing
+		std::vector<std::unique_ptr<T[]> >	text_blocks;
+		T*									text_next;
+		size_t								text_left;
+
+		shard()
+			: node_count(0)
+			, text_next(0)
+			, text_left(0)
+		{
+			for (size_t segment=0; segment<segment_count; ++segment)
+			{
+				segments[segment].store(0, std::memory_order_relaxed);
+			}
+		}
+
+		~shard()
+		{
+			for (size_t segment=0; segment<segment_count; ++segment)
+			{
+				delete[] segments[segment].load(std::memory_order_relaxed);
+			}
+		}
+	};
+
+	std::unique_ptr<shard[]>	shards;
+	std::atomic<size_t>			count;
+
+	basic_path_interner(const basic_path_interner&);
+	basic_path_interner& operator=(const basic_path_interner&);
+
+	static unsigned long long hash_key(id_t parent, const T* data, size_t length)
+	{
+		unsigned long long hash = internal::path_hash_seed;
+		hash ^= parent;
+		hash *= internal::path_hash_prime;
+		return internal::hash_path_element(hash, data, length);
+	}
+
+	static size_t segment_of(size_t index, size_t& offset)
+	{
+		size_t	n		= (index / first_segment_size) + 1;
+		size_t	segment	= 0;
+		while (n >>= 1)
+		{
+			++segment;
+		}
+		offset = index - (first_segment_size * ((size_t(1) << segment) - 1));
+		return segment;
+	}
+
+	const node& node_at(id_t id) const
+	{
+		if (id == none)
+		{
+			throw filesystem_error("Invalid path id", __FILE__, __LINE__, "", "");
+		}
+		const size_t	value	= id - 1;
+		size_t			offset	= 0;
+		const size_t	segment	= segment_of(value >> shard_bits, offset);
+		const node*		nodes	= shards[value & (shard_count - 1)].segments[segment].load(std::memory_order_acquire);
+		if (nodes == 0)
+		{
+			throw filesystem_error("Invalid path id", __FILE__, __LINE__, "", "");
+		}
+		return nodes[offset];
+	}
+
+	bool matches(id_t id, id_t parent, const T* data, size_t length) const
+	{
+		const node& n = node_at(id);
+		return (n.parent == parent) && internal::compare_path_element(n.data, n.length, data, length);
+	}
+
+	// Returns the slot holding the element, or the empty slot where it belongs.
+	size_t find_slot(const shard& s, unsigned int hash, id_t parent, const T* data, size_t length) const
+	{
+		const size_t mask = s.slots.size() - 1;
+		for (size_t index = hash & mask; ; index = (index + 1) & mask)
+		{
+			const slot& candidate = s.slots[index];
+			if ((candidate.id == none) ||
+				((candidate.hash == hash) && matches(candidate.id, parent, data, length)))
+			{
+				return index;
+			}
+		}
+	}
+
+	static void grow_slots(shard& s)
+	{
+		std::vector<slot> old_slots;
+		old_slots.swap(s.slots);
+		const slot empty = { none, 0 };
+		s.slots.assign(std::max<size_t>(64, old_slots.size() * 2), empty);
+
+		const size_t mask = s.slots.size() - 1;
+		for (size_t old=0; old<old_slots.size(); ++old)
+		{
+			if (old_slots[old].id != none)
+			{
+				size_t index = old_slots[old].hash & mask;
+				while (s.slots[index].id != none)
+				{
+					index = (index + 1) & mask;
+				}
+				s.slots[index] = old_slots[old];
+			}
+		}
+	}
+
+	static const T* store_text(shard& s, const T* data, size_t length)
+	{
+		if (length > s.text_left)
+		{
+			const size_t block_size = std::max(length, static_cast<size_t>(text_block_size));
+			s.text_blocks.push_back(std::unique_ptr<T[]>(new T[block_size]));
+			s.text_next = s.text_blocks.back().get();
+			s.text_left = block_size;
+		}
+		T* text = s.text_next;
+		std::copy(data, data + length, text);
+		s.text_next += length;
+		s.text_left -= length;
+		return text;
+	}
+
+	static id_t add_node(shard& s, size_t shard_index, id_t parent, const T* data, size_t length)
+	{
+		if (s.node_count >= max_shard_nodes)
+		{
+			throw filesystem_error("Path interner is full", __FILE__, __LINE__, "", "");
+		}
+		size_t			offset	= 0;
+		const size_t	segment	= segment_of(s.node_count, offset);
+		node*			nodes	= s.segments[segment].load(std::memory_order_relaxed);
+		if (nodes == 0)
+		{
+			nodes = new node[first_segment_size << segment];
+			s.segments[segment].store(nodes, std::memory_order_release);
+		}
+		nodes[offset].data		= store_text(s, data, length);
+		nodes[offset].length	= static_cast<unsigned int>(length);
+		nodes[offset].parent	= parent;
+
+		const id_t id = static_cast<id_t>(((s.node_count << shard_bits) | shard_index) + 1);
+		++s.node_count;
+		return id;
+	}
+
+public:
+	basic_path_interner()
+		: shards(new shard[shard_count])
+		, count(0)
+	{
+	}
+
+	// Returns the id of element under parent, adding it if needed.  Pass none
+	// as the parent of a root or first relative element.
+	id_t intern(id_t parent, const T* data, size_t length)
+	{
+		if (length == 0)
+		{
+			throw filesystem_error("Path element cannot be empty", __FILE__, __LINE__, "", "");
+		}
+		if (parent != none)
+		{
+			node_at(parent);
+		}
+		const unsigned long long	hash		= hash_key(parent, data, length);
+		const size_t				shard_index	= static_cast<size_t>(hash >> (64 - shard_bits));
+		const unsigned int			slot_hash	= static_cast<unsigned int>(hash);
+		shard&						s			= shards[shard_index];
+
+		std::lock_guard<std::mutex> guard(s.lock);
+		if ((s.node_count + 1) * 2 > s.slots.size())
+		{
+			grow_slots(s);
+		}
+		const size_t index = find_slot(s, slot_hash, parent, data, length);
+		if (s.slots[index].id == none)
+		{
+			s.slots[index].id	= add_node(s, shard_index, parent, data, length);
+			s.slots[index].hash	= slot_hash;
+			++count;
+		}
+		return s.slots[index].id;
+	}
+
+	id_t intern(id_t parent, const string_t& element)
+	{
+		return intern(parent, element.c_str(), element.size());
+	}
+
+	// Interns every prefix of path and returns the id of the whole path.
+	id_t intern(const path_t& path)
+	{
+		id_t id = none;
+		const size_t elems = path.element_count();
+		for (size_t elem=0; elem<elems; ++elem)
+		{
+			const element_view_t element = path.element(elem);
+			id = intern(id, element.data(), element.size());
+		}
+		return id;
+	}
+
+	// Returns the id of element under parent, or none if it was never interned.
+	id_t find(id_t parent, const T* data, size_t length) const
+	{
+		if (length == 0)
+		{
+			return none;
+		}
+		const unsigned long long	hash		= hash_key(parent, data, length);
+		const size_t				shard_index	= static_cast<size_t>(hash >> (64 - shard_bits));
+		shard&						s			= shards[shard_index];
+
+		std::lock_guard<std::mutex> guard(s.lock);
+		if (s.slots.empty())
+		{
+			return none;
+		}
+		return s.slots[find_slot(s, static_cast<unsigned int>(hash), parent, data, length)].id;
+	}
+
+	id_t find(const path_t& path) const
+	{
+		id_t id = none;
+		const size_t elems = path.element_count();
+		for (size_t elem=0; elem<elems; ++elem)
+		{
+			const element_view_t element = path.element(elem);
+			id = find(id, element.data(), element.size());
+			if (id == none)
+			{
+				break;
+			}
+		}
+		return id;
+	}
+
+	id_t parent(id_t id) const
+	{
+		return node_at(id).parent;
+	}
+
+	// The view stays valid for the lifetime of the interner.
+	element_view_t element(id_t id) const
+	{
+		const node& n = node_at(id);
+		return element_view_t(n.data, n.length);
+	}
+
+	// Rebuilds the full path of id.
+	path_t path(id_t id) const
+	{
+		std::vector<const node*> chain;
+		for (id_t at=id; (at != none) || chain.empty(); at=chain.back()->parent)
+		{
+			chain.push_back(&node_at(at));
+		}
+
+		string_t path_string;
+		for (size_t elem=chain.size(); elem>0; --elem)
+		{
+			// Root elements such as "/" and "c:/" already end with a separator.
+			if (!path_string.empty() && (path_string[path_string.size()-1] != '/'))
+			{
+				path_string.push_back('/');
+			}
+			path_string.append(chain[elem-1]->data, chain[elem-1]->length);
+		}
+		return path_t(std::move(path_string));
+	}
+
+	// Number of distinct ids, counting every prefix separately.
+	size_t size() const
+	{
+		return count;
+	}
+};
+
+typedef basic_path_interner<char>		path_interner;
+typedef basic_path_interner<wchar_t>	wpath_interner;
+#endif //#ifdef FS_CPP11_
+#endif // REGION: class basic_path_interner
+
+#if 1 // REGION: class basic_operation_batch
+#ifdef FS_CPP11_
+struct BatchOperation
+{
+	enum Enum
+	{
+		CreateDirectory,
+		RemoveFile,
+		RemoveDirectory,
+		Move,
+		CreateHardLink,
+	};
+};
+
+namespace internal
+{
+// Performs one batch operation with a blocking call.  Returns 0, or the errno
+// (GetLastError() on Windows) value describing the failure.  For Move, path1
+// is the old path; for CreateHardLink, path1 is the link and path2 its source.
+inline int execute_operation(BatchOperation::Enum type, const native_string_t& path1, const native_string_t& path2)
+{
+	#ifdef FS_WINDOWS_
+		std::wstring ext_path1 = path1;
+		to_win32_path(ext_path1);
+		prepend_extended_fs_indicator(ext_path1);
+		std::wstring ext_path2 = path2;
+		if (!ext_path2.empty())
+		{
+			to_win32_path(ext_path2);
+			prepend_extended_fs_indicator(ext_path2);
+		}
+
+		BOOL result = FALSE;
+		switch (type)
+		{
+			case BatchOperation::CreateDirectory:	result = CreateDirectoryW(ext_path1.c_str(), NULL);					break;
+			case BatchOperation::RemoveFile:		result = DeleteFileW(ext_path1.c_str());								break;
+			case BatchOperation::RemoveDirectory:	result = RemoveDirectoryW(ext_path1.c_str());							break;
+			case BatchOperation::Move:				result = MoveFileW(ext_path1.c_str(), ext_path2.c_str());				break;
+			case BatchOperation::CreateHardLink:	result = CreateHardLinkW(ext_path1.c_str(), ext_path2.c_str(), NULL);	break;
+		}
+		return result ? 0 : static_cast<int>(GetLastError());
+	#endif //#ifdef FS_WINDOWS_
+	#ifdef FS_POSIX_
+		int result = -1;
+		switch (type)
+		{
+			case BatchOperation::CreateDirectory:	result = mkdir(path1.c_str(), S_IRWXU | S_IRWXO | S_IRWXG);	break;
+			case BatchOperation::RemoveFile:		result = unlink(path1.c_str());								break;
+			case BatchOperation::RemoveDirectory:	result = rmdir(path1.c_str());								break;
+			case BatchOperation::Move:				result = rename(path1.c_str(), path2.c_str());				break;
+			case BatchOperation::CreateHardLink:	result = link(path2.c_str(), path1.c_str());				break;
+		}
+		return (result == 0) ? 0 : errno;
+	#endif //#ifdef FS_POSIX_
+}
+
+#ifdef FS_IO_URING_
+inline void prepare_operation(io_uring_sqe* sqe, BatchOperation::Enum type, const std::string& path1, const std::string& path2)
+{
+	sqe->fd		= AT_FDCWD;
+	sqe->addr	= reinterpret_cast<unsigned long long>(path1.c_str());
+	switch (type)
+	{
+		case BatchOperation::CreateDirectory:
+			sqe->opcode	= IORING_OP_MKDIRAT;
+			sqe->len	= S_IRWXU | S_IRWXO | S_IRWXG;
+			break;
+		case BatchOperation::RemoveFile:
+			sqe->opcode	= IORING_OP_UNLINKAT;
+			break;
+		case BatchOperation::RemoveDirectory:
+			sqe->opcode			= IORING_OP_UNLINKAT;
+			sqe->unlink_flags	= AT_REMOVEDIR;
+			break;
+		case BatchOperation::Move:
+			sqe->opcode	= IORING_OP_RENAMEAT;
+			sqe->len	= static_cast<unsigned int>(AT_FDCWD);
+			sqe->off	= reinterpret_cast<unsigned long long>(path2.c_str());
+			break;
+		case BatchOperation::CreateHardLink:
+			sqe->opcode	= IORING_OP_LINKAT;
+			sqe->addr	= reinterpret_cast<unsigned long long>(path2.c_str());
+			sqe->len	= static_cast<unsigned int>(AT_FDCWD);
+			sqe->off	= reinterpret_cast<unsigned long long>(path1.c_str());
+			break;
+	}
+}
+#endif //#ifdef FS_IO_URING_
+} //namespace internal
+
+// Queues file system changes and then performs them together, reporting an
+// error code per operation instead of throwing.  Operations that touch the
+// same path, or a path inside another one's, run in the order they were
+// queued: a directory is created before anything inside it and removed after
+// everything inside it.  Unrelated operations may run in any order and
+// overlap.  On Linux the operations are submitted through io_uring, up to
+// queue_depth at a time; elsewhere, or when io_uring is unavailable, they run
+// on up to queue_depth threads (at most a few per core).
+//
+//	operation_batch batch;
+//	batch.create_directory(dir);
+//	size_t op = batch.move(staged, dir / std::string("file"));
+//	if (batch.run() != 0 && batch.error(op) != 0) ...
+template<class T>
+class basic_operation_batch
+{
+public:
+	typedef T						char_t;
+	typedef std::basic_string<T>	string_t;
+	typedef basic_path<T>			path_t;
+
+private:
+	typedef internal::native_string_t	native_string_t;
+
+	struct operation
+	{
+		BatchOperation::Enum	type;
+		native_string_t			path1;
+		native_string_t			path2;
+		int						error;
+		unsigned int			dependency_count;
+		std::vector<size_t>		dependents;
+	};
+
+	std::vector<operation>										operations;
+	std::unordered_map<native_string_t, size_t>					last_exact;	// last operation on a path
+	std::unordered_map<native_string_t, std::vector<size_t> >	inside;		// operations below a path since the last one on it
+	native_string_t												cwd;
+
+	basic_operation_batch(const basic_operation_batch&);
+	basic_operation_batch& operator=(const basic_operation_batch&);
+
+	void add_dependency(size_t before, size_t after)
+	{
+		if (before != after)
+		{
+			operations[before].dependents.push_back(after);
+			++operations[after].dependency_count;
+		}
+	}
+
+	// Orders op after earlier operations on the path, on any directory
+	// containing it, and on anything inside it.
+	void order(size_t op, const path_t& path)
+	{
+		native_string_t key;
+		internal::convert_string(path.to_portable_string(), key);
+		if (path.is_relative())
+		{
+			if (cwd.empty())
+			{
+				internal::current_working_dir(cwd);
+			}
+			key = cwd + native_string_t(1, '/') + key;
+		}
+		#ifdef FS_WINDOWS_
+			for (size_t i=0; i<key.size(); ++i)
+			{
+				key[i] = (key[i] == '\\') ? L'/' : towlower(key[i]);
+			}
+		#endif //#ifdef FS_WINDOWS_
+
+		// Every directory containing the path.
+		for (size_t end=1; end<key.size(); ++end)
+		{
+			if (key[end] == '/')
+			{
+				const native_string_t parent(key, 0, end);
+				typename std::unordered_map<native_string_t, size_t>::const_iterator found = last_exact.find(parent);
+				if (found != last_exact.end())
+				{
+					add_dependency(found->second, op);
+				}
+				inside[parent].push_back(op);
+			}
+		}
+
+		// The path itself and anything inside it.
+		typename std::unordered_map<native_string_t, size_t>::iterator found = last_exact.find(key);
+		if (found != last_exact.end())
+		{
+			add_dependency(found->second, op);
+			found->second = op;
+		}
+		else
+		{
+			last_exact[key] = op;
+		}
+		typename std::unordered_map<native_string_t, std::vector<size_t> >::iterator below = inside.find(key);
+		if (below != inside.end())
+		{
+			for (size_t i=0; i<below->second.size(); ++i)
+			{
+				add_dependency(below->second[i], op);
+			}
+			inside.erase(below);
+		}
+	}
+
+	size_t add(BatchOperation::Enum type, const path_t& path1, const path_t* path2)
+	{
+		const size_t op = operations.size();
+		operations.push_back(operation());
+		operations.back().type				= type;
+		operations.back().error				= 0;
+		operations.back().dependency_count	= 0;
+		internal::convert_string(path1.to_portable_string(), operations.back().path1);
+		if (path2 != 0)
+		{
+			internal::convert_string(path2->to_portable_string(), operations.back().path2);
+		}
+
+		order(op, path1);
+		if (path2 != 0)
+		{
+			order(op, *path2);
+		}
+		return op;
+	}
+
+	void execute(size_t op)
+	{
+		operation& o = operations[op];
+		o.error = internal::execute_operation(o.type, o.path1, o.path2);
+	}
+
+#ifdef FS_IO_URING_
+	// Returns false if no io_uring instance could be created.
+	bool run_ring(unsigned int queue_depth)
+	{
+		internal::io_ring ring(queue_depth);
+		if (!ring.valid())
+		{
+			return false;
+		}
+
+		std::vector<unsigned int>	waiting(operations.size());
+		std::deque<size_t>			ready;
+		for (size_t op=0; op<operations.size(); ++op)
+		{
+			waiting[op] = operations[op].dependency_count;
+			if (waiting[op] == 0)
+			{
+				ready.push_back(op);
+			}
+		}
+
+		size_t in_flight = 0;
+		size_t completed = 0;
+		while (completed < operations.size())
+		{
+			while (!ready.empty() && (in_flight < ring.capacity()))
+			{
+				io_uring_sqe* sqe = ring.get_sqe();
+				if (sqe == 0)
+				{
+					break;
+				}
+				const size_t op = ready.front();
+				ready.pop_front();
+				internal::prepare_operation(sqe, operations[op].type, operations[op].path1, operations[op].path2);
+				sqe->user_data = op;
+				++in_flight;
+			}
+
+			if (!ring.submit(1))
+			{
+				throw filesystem_error("Failed to submit io_uring requests", __FILE__, __LINE__, "", "");
+			}
+
+			unsigned long long	user_data;
+			int					result;
+			while (ring.next_completion(user_data, result))
+			{
+				const size_t op = static_cast<size_t>(user_data);
+				--in_flight;
+				++completed;
+				if (result == -EINVAL)
+				{
+					execute(op); // the kernel may predate this operation
+				}
+				else
+				{
+					operations[op].error = -result;
+				}
+
+				const std::vector<size_t>& dependents = operations[op].dependents;
+				for (size_t i=0; i<dependents.size(); ++i)
+				{
+					if (--waiting[dependents[i]] == 0)
+					{
+						ready.push_back(dependents[i]);
+					}
+				}
+			}
+		}
+		return true;
+	}
+#endif //#ifdef FS_IO_URING_
+
+	void run_threads(unsigned int queue_depth)
+	{
+		std::unique_ptr<std::atomic<unsigned int>[]> waiting(new std::atomic<unsigned int>[operations.size()]);
+		for (size_t op=0; op<operations.size(); ++op)
+		{
+			waiting[op] = operations[op].dependency_count;
+		}
+
+		const unsigned int thread_count = (std::min)((std::max)(queue_depth, 1u), internal::blocking_thread_limit());
+		internal::work_stealing_pool pool(static_cast<unsigned int>((std::min)(static_cast<size_t>(thread_count), operations.size())));
+		std::function<void(unsigned int, size_t)> perform = [&](unsigned int worker, size_t op)
+		{
+			execute(op);
+			const std::vector<size_t>& dependents = operations[op].dependents;
+			for (size_t i=0; i<dependents.size(); ++i)
+			{
+				if (--waiting[dependents[i]] == 0)
+				{
+					const size_t next = dependents[i];
+					pool.push(worker, [&perform, next](unsigned int next_worker) { perform(next_worker, next); });
+				}
+			}
+		};
+		pool.run([&](unsigned int worker)
+		{
+			for (size_t op=0; op<operations.size(); ++op)
+			{
+				if (operations[op].dependency_count == 0)
+				{
+					pool.push(worker, [&perform, op](unsigned int next_worker) { perform(next_worker, op); });
+				}
+			}
+		});
+	}
+
+public:
+	basic_operation_batch()
+	{
+	}
+
+	// Each function queues an operation and returns its index for error().
+	size_t create_directory(const path_t& dir)
+	{
+		return add(BatchOperation::CreateDirectory, dir, 0);
+	}
+
+	size_t remove_file(const path_t& file)
+	{
+		return add(BatchOperation::RemoveFile, file, 0);
+	}
+
+	size_t remove_directory(const path_t& dir)
+	{
+		return add(BatchOperation::RemoveDirectory, dir, 0);
+	}
+
+	size_t move(const path_t& old_path, const path_t& new_path)
+	{
+		return add(BatchOperation::Move, old_path, &new_path);
+	}
+
+	size_t create_hard_link(const path_t& link, const path_t& source)
+	{
+		return add(BatchOperation::CreateHardLink, link, &source);
+	}
+
+	size_t size() const
+	{
+		return operations.size();
+	}
+
+	// Performs every queued operation and returns how many failed.
+	size_t run(unsigned int queue_depth = 128)
+	{
+		if (operations.empty())
+		{
+			return 0;
+		}
+
+		#ifdef FS_IO_URING_
+			if (!run_ring(queue_depth))
+			{
+				run_threads(queue_depth);
+			}
+		#else
+			run_threads(queue_depth);
+		#endif //#ifdef FS_IO_URING_
+
+		size_t failed = 0;
+		for (size_t op=0; op<operations.size(); ++op)
+		{
+			if (operations[op].error != 0)
+			{
+				++failed;
+			}
+		}
+		return failed;
+	}
+
+	// 0 if the operation succeeded, otherwise its errno value (GetLastError()
+	// on Windows).  Valid after run().
+	int error(size_t op) const
+	{
+		return operations.at(op).error;
+	}
+
+	void clear()
+	{
+		operations.clear();
+		last_exact.clear();
+		inside.clear();
+	}
+};
+
+typedef basic_operation_batch<char>		operation_batch;
+typedef basic_operation_batch<wchar_t>	woperation_batch;
+#endif //#ifdef FS_CPP11_
+#endif // REGION: class basic_operation_batch
+
+#if 1 // REGION: copy_tree
+#ifdef FS_CPP11_
+namespace internal
+{
+// Limits the bytes being copied at once.  A copy larger than the whole budget
+// waits for it to be entirely free.
+class byte_budget
+{
+	std::mutex				lock;
+	std::condition_variable	released;
+	unsigned long long		limit;
+	unsigned long long		available;
+
+	byte_budget(const byte_budget&);
+	byte_budget& operator=(const byte_budget&);
+
+public:
+	explicit byte_budget(unsigned long long limit_)
+		: limit((std::max)(limit_, 1ULL))
+		, available(limit)
+	{
+	}
+
+	// Waits for bytes to become available and returns the amount taken, to
+	// be handed back to release().
+	unsigned long long acquire(unsigned long long bytes)
+	{
+		const unsigned long long amount = (std::min)(bytes, limit);
+		std::unique_lock<std::mutex> guard(lock);
+		released.wait(guard, [this, amount]() { return available >= amount; });
+		available -= amount;
+		return amount;
+	}
+
+	void release(unsigned long long amount)
+	{
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			available += amount;
+		}
+		released.notify_all();
+	}
+};
+
+struct tree_file
+{
+	native_string_t		relative;
+	unsigned long long	size;
+};
+
+struct tree_error
+{
+	native_string_t		relative;
+	int					error;
+};
+
+// Lists the subdirectories and files below root, with paths relative to root.
+// Parents are listed before their subdirectories.  Symbolic links are
+// followed, except to a directory already being listed, which would never
+// end.  A directory that can't be listed is added to errors with the rest of
+// the tree still listed.
+inline void scan_tree(const native_string_t& root, std::vector<native_string_t>& dirs, std::vector<tree_file>& files, std::vector<tree_error>& errors)
+{
+	std::set<std::pair<unsigned long long, unsigned long long> >	visited;	// (device, inode), zero on Windows
+	const size_t													first_dir	= dirs.size();
+	const size_t													root_index	= static_cast<size_t>(-1);
+	std::vector<size_t>												pending(1, root_index);	// indexes into dirs
+	while (!pending.empty())
+	{
+		const size_t			index		= pending.back();
+		const native_string_t	relative	= (index == root_index) ? native_string_t() : dirs[index];
+		const native_string_t	dir			= relative.empty() ? root : (root + native_string_t(1, '/') + relative);
+		const native_string_t	prefix		= relative.empty() ? relative : (relative + native_string_t(1, '/'));
+		pending.pop_back();
+
+		const file_status status = get_status(dir, true);
+		if ((status.inode() != 0) &&
+			!visited.insert(std::make_pair(status.device(), status.inode())).second)
+		{
+			#ifdef FS_WINDOWS_
+				tree_error loop = { relative, ERROR_CANT_RESOLVE_FILENAME };
+			#endif //#ifdef FS_WINDOWS_
+			#ifdef FS_POSIX_
+				tree_error loop = { relative, ELOOP };
+			#endif //#ifdef FS_POSIX_
+			errors.push_back(loop);
+			dirs[index].clear();	// not created either
+			continue;
+		}
+
+		const size_t first_subdir = dirs.size();
+		try
+		{
+			{
+				directory_scanner scanner(dir, native_pattern_t(), false);
+				while (scanner.next())
+				{
+					unsigned int	filled	= 0;
+					tree_file		file;
+					file.relative	= prefix + scanner.name();
+					file.size		= scanner.status(EntryField::Size, filled).size();
+					files.push_back(file);
+				}
+			}
+			directory_scanner scanner(dir, native_pattern_t(), true);
+			while (scanner.next())
+			{
+				dirs.push_back(prefix + scanner.name());
+			}
+		}
+		catch (const filesystem_error&)
+		{
+			#ifdef FS_WINDOWS_
+				tree_error failure = { relative, static_cast<int>(GetLastError()) };
+			#endif //#ifdef FS_WINDOWS_
+			#ifdef FS_POSIX_
+				tree_error failure = { relative, errno };
+			#endif //#ifdef FS_POSIX_
+			errors.push_back(failure);
+			dirs.resize(first_subdir);
+			continue;
+		}
+		for (size_t i=dirs.size(); i>first_subdir; --i)
+		{
+			pending.push_back(i-1);
+		}
+	}
+	dirs.erase(std::remove(dirs.begin() + first_dir, dirs.end(), native_string_t()), dirs.end());
+}
+} //namespace internal
+
+// A file or directory that copy_tree couldn't copy.
+template<class T>
+struct basic_copy_error
+{
+	basic_path<T>	source;
+	basic_path<T>	destination;
+	int				error;	// errno value, or GetLastError() on Windows
+};
+
+typedef basic_copy_error<char>		copy_error;
+typedef basic_copy_error<wchar_t>	wcopy_error;
+
+// Copies the contents of the directory from into to, creating to if needed.
+// The tree is scanned first; every directory is then created in one batch,
+// and the files are copied with copy_file on thread_count threads (0 for one
+// per core) while at most max_in_flight_bytes of file data is being copied.
+// Symbolic links are followed, except to a directory already being copied.
+// A file or directory that fails, or can't be listed, is added to errors and
+// the rest of the tree is still copied.  Returns the number of
+// files copied.  options is a mask of CopyOption values.
+template <class T>
+size_t copy_tree(const basic_path<T>& from, const basic_path<T>& to, std::vector<basic_copy_error<T> >& errors,
+				 unsigned int options = CopyOption::None, unsigned int thread_count = 0, unsigned long long max_in_flight_bytes = 256ULL * 1024 * 1024)
+{
+	typedef std::basic_string<T> string_t;
+	#ifdef FS_WINDOWS_
+		const int already_exists = ERROR_ALREADY_EXISTS;
+	#endif //#ifdef FS_WINDOWS_
+	#ifdef FS_POSIX_
+		const int already_exists = EEXIST;
+	#endif //#ifdef FS_POSIX_
+
+	errors.clear();
+
+	internal::native_string_t nfrom, nto;
+	internal::convert_string(from.to_portable_string(), nfrom);
+	internal::convert_string(to.to_portable_string(), nto);
+
+	std::vector<internal::native_string_t>	dirs;
+	std::vector<internal::tree_file>		files;
+	std::vector<internal::tree_error>		scan_errors;
+	internal::scan_tree(nfrom, dirs, files, scan_errors);
+
+	string_t relative;
+	for (size_t i=0; i<scan_errors.size(); ++i)
+	{
+		internal::convert_string(scan_errors[i].relative, relative);
+		basic_copy_error<T> failure = { from / relative, to / relative, scan_errors[i].error };
+		errors.push_back(failure);
+	}
+
+	create_directories(to);
+	{
+		basic_operation_batch<T> batch;
+		for (size_t i=0; i<dirs.size(); ++i)
+		{
+			internal::convert_string(dirs[i], relative);
+			batch.create_directory(to / relative);
+		}
+		batch.run();
+		for (size_t i=0; i<dirs.size(); ++i)
+		{
+			if ((batch.error(i) != 0) && (batch.error(i) != already_exists))
+			{
+				internal::convert_string(dirs[i], relative);
+				basic_copy_error<T> failure = { from / relative, to / relative, batch.error(i) };
+				errors.push_back(failure);
+			}
+		}
+	}
+
+	// Larger files first, so they don't end up alone at the end.
+	std::sort(files.begin(), files.end(), [](const internal::tree_file& a, const internal::tree_file& b) { return a.size > b.size; });
+
+	internal::work_stealing_pool	pool(thread_count);
+	internal::byte_budget			budget(max_in_flight_bytes);
+	std::atomic<size_t>				copied(0);
+	std::mutex						errors_lock;
+	pool.run([&](unsigned int worker)
+	{
+		for (size_t i=files.size(); i>0; --i) // the pool runs its own queue last in, first out
+		{
+			const internal::tree_file* file = &files[i-1];
+			pool.push(worker, [&, file](unsigned int)
+			{
+				const internal::native_string_t	source		= nfrom + internal::native_string_t(1, '/') + file->relative;
+				const internal::native_string_t	destination	= nto + internal::native_string_t(1, '/') + file->relative;
+
+				const unsigned long long	amount	= budget.acquire(file->size);
+				const int					error	= internal::try_copy_file(source, destination, options);
+				budget.release(amount);
+
+				if (error == 0)
+				{
+					++copied;
 					return;
 				}
-				path_elems.push_back(path_.substr(0, nextDelimiter));
-				searchIndex = nextDelimiter + 1;
+				string_t relative;
+				internal::convert_string(file->relative, relative);
+				basic_copy_error<T> failure = { from / relative, to / relative, error };
+				std::lock_guard<std::mutex> guard(errors_lock);
+				errors.push_back(failure);
+			});
+		}
+	});
+	return copied;
+}
+#endif //#ifdef FS_CPP11_
+#endif // REGION: copy_tree
+
+#if 1 // REGION: class mapped_file
+struct MapAccess
+{
+	enum Enum
+	{
+		ReadOnly,
+		ReadWrite,		// changes are written back to the file
+	};
+};
+
+// Access pattern hints for mapped_file::advise.
+struct MapAdvice
+{
+	enum Enum
+	{
+		Normal,
+		Sequential,		// read ahead aggressively, drop pages behind
+		Random,			// don't read ahead
+		WillNeed,		// start reading the range in now
+		HugePage,		// back the range with huge pages where supported
+	};
+};
+
+namespace internal
+{
+struct file_mapping
+{
+	char*	view;		// start of the mapping, aligned to the allocation granularity
+	size_t	view_size;
+	char*	first;		// first requested byte, inside the view
+	size_t	length;
+	bool	writable;
+	#ifdef FS_WINDOWS_
+		HANDLE	file;
+	#endif //#ifdef FS_WINDOWS_
+
+	file_mapping()
+		: view(0)
+		, view_size(0)
+		, first(0)
+		, length(0)
+		, writable(false)
+		#ifdef FS_WINDOWS_
+		, file(INVALID_HANDLE_VALUE)
+		#endif //#ifdef FS_WINDOWS_
+	{
+	}
+};
+
+inline size_t mapping_granularity()
+{
+	#ifdef FS_WINDOWS_
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		return info.dwAllocationGranularity;
+	#endif //#ifdef FS_WINDOWS_
+	#ifdef FS_POSIX_
+		return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	#endif //#ifdef FS_POSIX_
+}
+
+inline void unmap_file(file_mapping& mapping)
+{
+	#ifdef FS_WINDOWS_
+		if (mapping.view != 0)
+		{
+			UnmapViewOfFile(mapping.view);
+		}
+		if (mapping.file != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(mapping.file);
+		}
+	#endif //#ifdef FS_WINDOWS_
+	#ifdef FS_POSIX_
+		if (mapping.view != 0)
+		{
+			munmap(mapping.view, mapping.view_size);
+		}
+	#endif //#ifdef FS_POSIX_
+	mapping = file_mapping();
+}
+
+// Maps length bytes of the existing file path starting at offset; the range
+// is cut short at the end of the file.  An empty range maps nothing.
+inline void map_file(const native_string_t& path, bool writable, unsigned long long offset, size_t length, file_mapping& mapping)
+{
+	std::string error_path;
+	unsigned long long file_size = 0;
+	file_mapping result;
+	result.writable = writable;
+
+	#ifdef FS_WINDOWS_
+		std::wstring ext_path = path;
+		to_win32_path(ext_path);
+		prepend_extended_fs_indicator(ext_path);
+
+		result.file = CreateFileW(ext_path.c_str(), GENERIC_READ | (writable ? GENERIC_WRITE : 0),
+								  FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+								  OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		LARGE_INTEGER size;
+		if ((result.file == INVALID_HANDLE_VALUE) || (0 == GetFileSizeEx(result.file, &size)))
+		{
+			unmap_file(result);
+			convert_string(path, error_path);
+			GENERARE_FILESYSTEM_ERROR1(error_path);
+		}
+		file_size = static_cast<unsigned long long>(size.QuadPart);
+	#endif //#ifdef FS_WINDOWS_
+	#ifdef FS_POSIX_
+		int fd = open(path.c_str(), (writable ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+		struct stat info;
+		if ((fd == -1) || (fstat(fd, &info) != 0))
+		{
+			if (fd != -1)
+			{
+				int error = errno;
+				close(fd);
+				errno = error;
+			}
+			GENERARE_FILESYSTEM_ERROR1(path);
+		}
+		file_size = static_cast<unsigned long long>(info.st_size);
+	#endif //#ifdef FS_POSIX_
+
+	if (offset < file_size)
+	{
+		result.length = static_cast<size_t>((std::min)(static_cast<unsigned long long>(length), file_size - offset));
+	}
+	if (result.length != 0)
+	{
+		const unsigned long long view_offset = offset - (offset % mapping_granularity());
+		result.view_size = result.length + static_cast<size_t>(offset - view_offset);
+
+		#ifdef FS_WINDOWS_
+			HANDLE section = CreateFileMappingW(result.file, NULL, writable ? PAGE_READWRITE : PAGE_READONLY, 0, 0, NULL);
+			if (section != NULL)
+			{
+				result.view = static_cast<char*>(MapViewOfFile(section, writable ? FILE_MAP_WRITE : FILE_MAP_READ,
+															   static_cast<DWORD>(view_offset >> 32), static_cast<DWORD>(view_offset),
+															   result.view_size));
+				// The view keeps the section alive.
+				DWORD error = GetLastError();
+				CloseHandle(section);
+				SetLastError(error);
+			}
+			if (result.view == 0)
+			{
+				DWORD error = GetLastError();
+				unmap_file(result);
+				SetLastError(error);
+				convert_string(path, error_path);
+				GENERARE_FILESYSTEM_ERROR1(error_path);
+			}
+		#endif //#ifdef FS_WINDOWS_
+		#ifdef FS_POSIX_
+			void* view = mmap(0, result.view_size, PROT_READ | (writable ? PROT_WRITE : 0), MAP_SHARED, fd, static_cast<off_t>(view_offset));
+			if (view == MAP_FAILED)
+			{
+				int error = errno;
+				close(fd);
+				errno = error;
+				GENERARE_FILESYSTEM_ERROR1(path);
+			}
+			result.view = static_cast<char*>(view);
+		#endif //#ifdef FS_POSIX_
+		result.first = result.view + (offset - view_offset);
+	}
+
+	#ifdef FS_POSIX_
+		// The mapping doesn't need the descriptor.
+		close(fd);
+	#endif //#ifdef FS_POSIX_
+	unmap_file(mapping);
+	mapping = result;
+}
+
+inline void flush_mapping(const file_mapping& mapping)
+{
+	if (!mapping.writable || (mapping.view == 0))
+	{
+		return;
+	}
+	#ifdef FS_WINDOWS_
+		if ((0 == FlushViewOfFile(mapping.view, mapping.view_size)) ||
+			(0 == FlushFileBuffers(mapping.file)))
+		{
+			GENERARE_FILESYSTEM_ERROR0();
+		}
+	#endif //#ifdef FS_WINDOWS_
+	#ifdef FS_POSIX_
+		if (msync(mapping.view, mapping.view_size, MS_SYNC) != 0)
+		{
+			GENERARE_FILESYSTEM_ERROR0();
+		}
+	#endif //#ifdef FS_POSIX_
+}
+
+inline bool advise_mapping(const file_mapping& mapping, MapAdvice::Enum advice, size_t offset, size_t length)
+{
+	if (offset >= mapping.length)
+	{
+		return false;
+	}
+	length = (std::min)(length, mapping.length - offset);
+
+	// The range handed to the system has to start on a page boundary.
+	char* start = mapping.first + offset;
+	char* aligned = mapping.view + ((start - mapping.view) / mapping_granularity()) * mapping_granularity();
+	length += static_cast<size_t>(start - aligned);
+
+	#ifdef FS_WINDOWS_
+		#if defined(_WIN32_WINNT) && (_WIN32_WINNT >= 0x0602)
+			if (advice == MapAdvice::WillNeed)
+			{
+				WIN32_MEMORY_RANGE_ENTRY range;
+				range.VirtualAddress	= aligned;
+				range.NumberOfBytes		= length;
+				return (0 != PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0));
+			}
+		#endif
+		// The other hints have no Win32 equivalent for file views.
+		return (advice == MapAdvice::Normal);
+	#endif //#ifdef FS_WINDOWS_
+	#ifdef FS_POSIX_
+		int native_advice = MADV_NORMAL;
+		switch (advice)
+		{
+		case MapAdvice::Normal:		native_advice = MADV_NORMAL;		break;
+		case MapAdvice::Sequential:	native_advice = MADV_SEQUENTIAL;	break;
+		case MapAdvice::Random:		native_advice = MADV_RANDOM;		break;
+		case MapAdvice::WillNeed:	native_advice = MADV_WILLNEED;		break;
+		case MapAdvice::HugePage:
+			#ifdef MADV_HUGEPAGE
+				native_advice = MADV_HUGEPAGE;
+				break;
+			#else
+				return false;
+			#endif
+		}
+		return (madvise(aligned, length, native_advice) == 0);
+	#endif //#ifdef FS_POSIX_
+}
+} //namespace internal
+
+// A view of a file's contents mapped into memory, so they can be read (or,
+// with MapAccess::ReadWrite, changed) in place through the page cache rather
+// than copied through stream buffers.  The file must exist; a mapping never
+// extends past the end of the file, and an empty range maps nothing.
+class mapped_file
+{
+	internal::file_mapping mapping;
+
+	mapped_file(const mapped_file&);
+	mapped_file& operator=(const mapped_file&);
+
+public:
+	static const size_t npos = static_cast<size_t>(-1);
+
+	mapped_file()
+	{
+	}
+
+	// Maps length bytes starting at offset; offset needn't be page aligned.
+	template <class T>
+	explicit mapped_file(const basic_path<T>& path, MapAccess::Enum access = MapAccess::ReadOnly, unsigned long long offset = 0, size_t length = npos)
+	{
+		open(path, access, offset, length);
+	}
+
+	#ifdef FS_CPP11_
+	mapped_file(mapped_file&& other) noexcept
+	{
+		swap(other);
+	}
+
+	mapped_file& operator=(mapped_file&& other) noexcept
+	{
+		swap(other);
+		return *this;
+	}
+	#endif //#ifdef FS_CPP11_
+
+	~mapped_file()
+	{
+		internal::unmap_file(mapping);
+	}
+
+	template <class T>
+	void open(const basic_path<T>& path, MapAccess::Enum access = MapAccess::ReadOnly, unsigned long long offset = 0, size_t length = npos)
+	{
+		internal::native_string_t npath;
+		internal::convert_string(path.to_portable_string(), npath);
+		internal::map_file(npath, access == MapAccess::ReadWrite, offset, length, mapping);
+	}
+
+	void close()
+	{
+		internal::unmap_file(mapping);
+	}
+
+	// Writes changes through to the file and waits for them to reach the disk.
+	void flush() const
+	{
+		internal::flush_mapping(mapping);
+	}
+
+	// Hints how [offset, offset + length) of the view will be used.  Returns
+	// false where the system doesn't support or rejected the hint.
+	bool advise(MapAdvice::Enum advice, size_t offset = 0, size_t length = npos) const
+	{
+		return internal::advise_mapping(mapping, advice, offset, length);
+	}
+
+	void swap(mapped_file& other)
+	{
+		std::swap(mapping, other.mapping);
+	}
+
+	bool is_writable() const
+	{ return mapping.writable;}
+
+	bool empty() const
+	{ return mapping.length == 0;}
+
+	size_t size() const
+	{ return mapping.length;}
+
+	const char* data() const
+	{ return mapping.first;}
+
+	// Null unless mapped with MapAccess::ReadWrite.
+	char* mutable_data() const
+	{ return mapping.writable ? mapping.first : 0;}
+
+	#ifdef FS_STRING_VIEW_
+	std::string_view view() const
+	{ return std::string_view(mapping.first, mapping.length);}
+	#endif //#ifdef FS_STRING_VIEW_
+
+	#ifdef FS_SPAN_
+	std::span<const char> span() const
+	{ return std::span<const char>(mapping.first, mapping.length);}
+
+	// Empty unless mapped with MapAccess::ReadWrite.
+	std::span<char> mutable_span() const
+	{ return mapping.writable ? std::span<char>(mapping.first, mapping.length) : std::span<char>();}
+	#endif //#ifdef FS_SPAN_
+};
+#endif // REGION: class mapped_file
+
+#if 1 // REGION: class file
+struct FileMode
+{
+	enum Enum
+	{
+		Read		= 0x01,
+		Write		= 0x02,
+		ReadWrite	= Read | Write,
+		Create		= 0x04,		// create the file if it doesn't exist
+		Truncate	= 0x08,
+		Append		= 0x10,		// every write goes to the end of the file
+		Exclusive	= 0x20,		// with Create, fail if the file already exists
+		Direct		= 0x40,		// bypass the page cache (O_DIRECT, FILE_FLAG_NO_BUFFERING)
+	};
+};
+
+// One piece of a vectored read or write.
+struct io_buffer
+{
+	void*	data;
+	size_t	size;
+};
+
+namespace internal
+{
+#ifdef FS_WINDOWS_
+typedef HANDLE native_file_t;
+const native_file_t invalid_file = INVALID_HANDLE_VALUE;
+#endif //#ifdef FS_WINDOWS_
+#ifdef FS_POSIX_
+typedef int native_file_t;
+const native_file_t invalid_file = -1;
+#endif //#ifdef FS_POSIX_
+
+#ifdef FS_POSIX_
+inline int open_flags(unsigned int mode)
+{
+	int flags = O_CLOEXEC;
+	switch (mode & FileMode::ReadWrite)
+	{
+	case FileMode::Write:		flags |= O_WRONLY;	break;
+	case FileMode::ReadWrite:	flags |= O_RDWR;	break;
+	default:					flags |= O_RDONLY;	break;
+	}
+	if ((mode & FileMode::Create) != 0)
+	{
+		flags |= O_CREAT;
+	}
+	if ((mode & FileMode::Exclusive) != 0)
+	{
+		flags |= O_EXCL;
+	}
+	if ((mode & FileMode::Truncate) != 0)
+	{
+		flags |= O_TRUNC;
+	}
+	if ((mode & FileMode::Append) != 0)
+	{
+		flags |= O_APPEND;
+	}
+	#ifdef O_DIRECT
+		if ((mode & FileMode::Direct) != 0)
+		{
+			flags |= O_DIRECT;
+		}
+	#endif //#ifdef O_DIRECT
+	return flags;
+}
+#endif //#ifdef FS_POSIX_
+
+inline native_file_t open_file(const native_string_t& path, unsigned int mode, unsigned int permissions)
+{
+	#ifdef FS_WINDOWS_
+		std::wstring ext_path = path;
+		to_win32_path(ext_path);
+		prepend_extended_fs_indicator(ext_path);
+
+		DWORD access = 0;
+		if ((mode & FileMode::Read) != 0)
+		{
+			access |= GENERIC_READ;
+		}
+		if ((mode & FileMode::Write) != 0)
+		{
+			// Without FILE_WRITE_DATA every write goes to the end of the file.
+			access |= ((mode & FileMode::Append) != 0) ? (FILE_GENERIC_WRITE & ~FILE_WRITE_DATA) : GENERIC_WRITE;
+		}
+		DWORD disposition = OPEN_EXISTING;
+		if ((mode & FileMode::Create) != 0)
+		{
+			disposition = ((mode & FileMode::Exclusive) != 0) ? CREATE_NEW :
+						  ((mode & FileMode::Truncate) != 0) ? CREATE_ALWAYS : OPEN_ALWAYS;
+		}
+		else if ((mode & FileMode::Truncate) != 0)
+		{
+			disposition = TRUNCATE_EXISTING;
+		}
+		(void)permissions;
+
+		native_file_t handle = CreateFileW(ext_path.c_str(), access, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+										   disposition, FILE_ATTRIBUTE_NORMAL | (((mode & FileMode::Direct) != 0) ? FILE_FLAG_NO_BUFFERING : 0), NULL);
+		if (handle == INVALID_HANDLE_VALUE)
+		{
+			std::string error_path;
+			convert_string(path, error_path);
+			GENERARE_FILESYSTEM_ERROR1(error_path);
+		}
+		return handle;
+	#endif //#ifdef FS_WINDOWS_
+	#ifdef FS_POSIX_
+		int fd = open(path.c_str(), open_flags(mode), permissions);
+		if (fd == -1)
+		{
+			GENERARE_FILESYSTEM_ERROR1(path);
+		}
+		#if !defined(O_DIRECT) && defined(F_NOCACHE)
+			if ((mode & FileMode::Direct) != 0)
+			{
+				fcntl(fd, F_NOCACHE, 1);
+			}
+		#endif
+		return fd;
+	#endif //#ifdef FS_POSIX_
+}
+
+inline void close_file(native_file_t handle)
+{
+	#ifdef FS_WINDOWS_
+		CloseHandle(handle);
+	#endif //#ifdef FS_WINDOWS_
+	#ifdef FS_POSIX_
+		::close(handle);
+	#endif //#ifdef FS_POSIX_
+}
+
+// Moves the file position, relative to the current one if from_current, and
+// returns the new position.
+inline unsigned long long seek_file(native_file_t handle, long long offset, bool from_current)
+{
+	#ifdef FS_WINDOWS_
+		LARGE_INTEGER distance, position;
+		distance.QuadPart = offset;
+		if (0 == SetFilePointerEx(handle, distance, &position, from_current ? FILE_CURRENT : FILE_BEGIN))
+		{
+			GENERARE_FILESYSTEM_ERROR0();
+		}
+		return static_cast<unsigned long long>(position.QuadPart);
+	#endif //#ifdef FS_WINDOWS_
+	#ifdef FS_POSIX_
+		off_t position = lseek(handle, static_cast<off_t>(offset), from_current ? SEEK_CUR : SEEK_SET);
+		if (position == -1)
+		{
+			GENERARE_FILESYSTEM_ERROR0();
+		}
+		return static_cast<unsigned long long>(position);
+	#endif //#ifdef FS_POSIX_
+}
+
+// Reads up to size bytes at offset, or at the file position if offset is
+// null.  Returns fewer bytes only at the end of the file.
+inline size_t read_file(native_file_t handle, void* data, size_t size, const unsigned long long* offset)
+{
+	char* target = static_cast<char*>(data);
+	size_t done = 0;
+	#ifdef FS_WINDOWS_
+		// A positioned ReadFile also moves the file position; put it back.
+		LARGE_INTEGER saved = {};
+		if (offset != 0)
+		{
+			saved.QuadPart = static_cast<LONGLONG>(seek_file(handle, 0, true));
+		}
+		while (done < size)
+		{
+			DWORD		chunk	= static_cast<DWORD>((std::min)(size - done, static_cast<size_t>(0x40000000)));
+			DWORD		count	= 0;
+			OVERLAPPED	at		= {};
+			if (offset != 0)
+			{
+				at.Offset		= static_cast<DWORD>(*offset + done);
+				at.OffsetHigh	= static_cast<DWORD>((*offset + done) >> 32);
+			}
+			if (0 == ReadFile(handle, target + done, chunk, &count, (offset != 0) ? &at : NULL))
+			{
+				if (GetLastError() == ERROR_HANDLE_EOF)
+				{
+					break;
+				}
+				GENERARE_FILESYSTEM_ERROR0();
 			}
-			else
+			done += count;
+			if (count < chunk)
 			{
-				// we have a non-UNC root path.  Just set the first element to "/"
-				path_elems.push_back(string_t(1, '/'));
-				searchIndex = 1;
+				break;
 			}
 		}
-		else
+		if (offset != 0)
 		{
-			if ((path_.length() >= 2) &&
-				(path_[1] == ':') &&
-				(
-				 ((path_[0] >= 'A') && (path_[0] <= 'Z')) ||
-				 ((path_[0] >= 'a') && (path_[0] <= 'z'))
-				)
-			   )
+			SetFilePointerEx(handle, saved, NULL, FILE_BEGIN);
+		}
+	#endif //#ifdef FS_WINDOWS_
+	#ifdef FS_POSIX_
+		while (done < size)
+		{
+			const size_t chunk = size - done;
+			ssize_t count = (offset != 0) ? pread(handle, target + done, chunk, static_cast<off_t>(*offset + done))
+										  : ::read(handle, target + done, chunk);
+			if (count < 0)
 			{
-				// we have a drive specification.
-				drive_specified = true;
+				if (errno == EINTR)
+				{
+					continue;
+				}
+				GENERARE_FILESYSTEM_ERROR0();
+			}
+			done += static_cast<size_t>(count);
+			// A short read from a regular file means the end of it.  With
+			// O_DIRECT another read from the unaligned position would fail.
+			if (static_cast<size_t>(count) < chunk)
+			{
+				break;
+			}
+		}
+	#endif //#ifdef FS_POSIX_
+	return done;
+}
 
-				if ((path_.length() >= 3) &&
-					(path_[2] == '/'))
+// Writes all size bytes at offset, or at the file position if offset is null.
+inline void write_file(native_file_t handle, const void* data, size_t size, const unsigned long long* offset)
+{
+	const char* source = static_cast<const char*>(data);
+	size_t done = 0;
+	#ifdef FS_WINDOWS_
+		LARGE_INTEGER saved = {};
+		if (offset != 0)
+		{
+			saved.QuadPart = static_cast<LONGLONG>(seek_file(handle, 0, true));
+		}
+		while (done < size)
+		{
+			DWORD		chunk	= static_cast<DWORD>((std::min)(size - done, static_cast<size_t>(0x40000000)));
+			DWORD		count	= 0;
+			OVERLAPPED	at		= {};
+			if (offset != 0)
+			{
+				at.Offset		= static_cast<DWORD>(*offset + done);
+				at.OffsetHigh	= static_cast<DWORD>((*offset + done) >> 32);
+			}
+			if ((0 == WriteFile(handle, source + done, chunk, &count, (offset != 0) ? &at : NULL)) || (count == 0))
+			{
+				GENERARE_FILESYSTEM_ERROR0();
+			}
+			done += count;
+		}
+		if (offset != 0)
+		{
+			SetFilePointerEx(handle, saved, NULL, FILE_BEGIN);
+		}
+	#endif //#ifdef FS_WINDOWS_
+	#ifdef FS_POSIX_
+		while (done < size)
+		{
+			ssize_t count = (offset != 0) ? pwrite(handle, source + done, size - done, static_cast<off_t>(*offset + done))
+										  : ::write(handle, source + done, size - done);
+			if (count < 0)
+			{
+				if (errno == EINTR)
 				{
-					relative = false;
-					path_elems.push_back(path_.substr(0, 3));
-					searchIndex = 3;
+					continue;
+				}
+				GENERARE_FILESYSTEM_ERROR0();
+			}
+			done += static_cast<size_t>(count);
+		}
+	#endif //#ifdef FS_POSIX_
+}
+
+// Writes at the file position through the page cache even if the file was
+// opened with FileMode::Direct, for a final piece that isn't block aligned.
+inline void write_file_cached(native_file_t handle, const void* data, size_t size, unsigned int mode)
+{
+	#ifdef FS_WINDOWS_
+		if ((mode & FileMode::Direct) != 0)
+		{
+			HANDLE cached = ReOpenFile(handle, GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, 0);
+			if (cached == INVALID_HANDLE_VALUE)
+			{
+				GENERARE_FILESYSTEM_ERROR0();
+			}
+			unsigned long long position = 0;
+			LARGE_INTEGER end;
+			if ((mode & FileMode::Append) != 0)
+			{
+				GetFileSizeEx(handle, &end);
+				position = static_cast<unsigned long long>(end.QuadPart);
+			}
+			else
+			{
+				position = seek_file(handle, 0, true);
+			}
+			try
+			{
+				write_file(cached, data, size, &position);
+			}
+			catch (...)
+			{
+				CloseHandle(cached);
+				throw;
+			}
+			CloseHandle(cached);
+			seek_file(handle, static_cast<long long>(position + size), false);
+			return;
+		}
+	#endif //#ifdef FS_WINDOWS_
+	#if defined(FS_LINUX_) && defined(O_DIRECT)
+		// O_DIRECT belongs to the open file description, which may be shared, so
+		// the descriptor is reopened without it rather than changed in place.
+		if ((mode & FileMode::Direct) != 0)
+		{
+			char proc_path[64];
+			snprintf(proc_path, sizeof(proc_path), "/proc/self/fd/%d", handle);
+			int cached = open(proc_path, O_WRONLY | O_CLOEXEC | (((mode & FileMode::Append) != 0) ? O_APPEND : 0));
+			if (cached == -1)
+			{
+				GENERARE_FILESYSTEM_ERROR0();
+			}
+			try
+			{
+				if ((mode & FileMode::Append) != 0)
+				{
+					write_file(cached, data, size, 0);
+					seek_file(handle, static_cast<long long>(seek_file(cached, 0, true)), false);
 				}
 				else
 				{
-					path_elems.push_back(path_.substr(0, 2));
-					searchIndex = 2;
+					const unsigned long long position = seek_file(handle, 0, true);
+					write_file(cached, data, size, &position);
+					seek_file(handle, static_cast<long long>(position + size), false);
 				}
 			}
+			catch (...)
+			{
+				::close(cached);
+				throw;
+			}
+			::close(cached);
+			return;
 		}
+	#endif
+	(void)mode;
+	write_file(handle, data, size, 0);
+}
 
-		// Now parse the remainding part of the path string.
-		if (searchIndex != string_t::npos)
+// Reads or writes a list of buffers in order, at offset or at the file
+// position if offset is null.  Returns the bytes transferred; a read stops
+// early only at the end of the file.
+inline size_t transfer_buffers(native_file_t handle, const io_buffer* buffers, size_t count, const unsigned long long* offset, bool writing)
+{
+	size_t done = 0;
+	#if defined(FS_POSIX_)
+		std::vector<struct iovec> vectors(count);
+		for (size_t i=0; i<count; ++i)
+		{
+			vectors[i].iov_base	= buffers[i].data;
+			vectors[i].iov_len	= buffers[i].size;
+		}
+		size_t first = 0;
+		while (first < count)
+		{
+			const int	batch		= static_cast<int>((std::min)(count - first, static_cast<size_t>(IOV_MAX)));
+			size_t		requested	= 0;
+			for (int i=0; i<batch; ++i)
+			{
+				requested += vectors[first + i].iov_len;
+			}
+			ssize_t transferred;
+			if (offset != 0)
+			{
+				const off_t position = static_cast<off_t>(*offset + done);
+				#ifdef FS_LINUX_
+					transferred = writing ? pwritev(handle, &vectors[first], batch, position) : preadv(handle, &vectors[first], batch, position);
+				#else
+					// Positioned vectored calls aren't available everywhere.
+					transferred = writing ? pwrite(handle, vectors[first].iov_base, vectors[first].iov_len, position)
+										  : pread(handle, vectors[first].iov_base, vectors[first].iov_len, position);
+					requested = vectors[first].iov_len;
+				#endif //#ifdef FS_LINUX_
+			}
+			else
+			{
+				transferred = writing ? ::writev(handle, &vectors[first], batch) : ::readv(handle, &vectors[first], batch);
+			}
+			if (transferred < 0)
+			{
+				if (errno == EINTR)
+				{
+					continue;
+				}
+				GENERARE_FILESYSTEM_ERROR0();
+			}
+			done += static_cast<size_t>(transferred);
+			if (!writing && (static_cast<size_t>(transferred) < requested))
+			{
+				break;
+			}
+
+			size_t left = static_cast<size_t>(transferred);
+			while ((first < count) && (left >= vectors[first].iov_len))
+			{
+				left -= vectors[first].iov_len;
+				++first;
+			}
+			if (first < count)
+			{
+				vectors[first].iov_base	= static_cast<char*>(vectors[first].iov_base) + left;
+				vectors[first].iov_len	-= left;
+			}
+		}
+	#else
+		// Win32 only scatters and gathers whole pages of unbuffered files.
+		for (size_t i=0; i<count; ++i)
+		{
+			unsigned long long position = (offset != 0) ? (*offset + done) : 0;
+			if (writing)
+			{
+				write_file(handle, buffers[i].data, buffers[i].size, (offset != 0) ? &position : 0);
+				done += buffers[i].size;
+			}
+			else
+			{
+				const size_t transferred = read_file(handle, buffers[i].data, buffers[i].size, (offset != 0) ? &position : 0);
+				done += transferred;
+				if (transferred < buffers[i].size)
+				{
+					break;
+				}
+			}
+		}
+	#endif
+	return done;
+}
+
+inline unsigned long long file_size(native_file_t handle)
+{
+	#ifdef FS_WINDOWS_
+		LARGE_INTEGER size;
+		if (0 == GetFileSizeEx(handle, &size))
+		{
+			GENERARE_FILESYSTEM_ERROR0();
+		}
+		return static_cast<unsigned long long>(size.QuadPart);
+	#endif //#ifdef FS_WINDOWS_
+	#ifdef FS_POSIX_
+		struct stat info;
+		if (fstat(handle, &info) != 0)
+		{
+			GENERARE_FILESYSTEM_ERROR0();
+		}
+		return static_cast<unsigned long long>(info.st_size);
+	#endif //#ifdef FS_POSIX_
+}
+
+inline void resize_file(native_file_t handle, unsigned long long size)
+{
+	#ifdef FS_WINDOWS_
+		const unsigned long long position = seek_file(handle, 0, true);
+		seek_file(handle, static_cast<long long>(size), false);
+		const BOOL resized = SetEndOfFile(handle);
+		const DWORD error = GetLastError();
+		seek_file(handle, static_cast<long long>(position), false);
+		if (0 == resized)
+		{
+			SetLastError(error);
+			GENERARE_FILESYSTEM_ERROR0();
+		}
+	#endif //#ifdef FS_WINDOWS_
+	#ifdef FS_POSIX_
+		if (ftruncate(handle, static_cast<off_t>(size)) != 0)
+		{
+			GENERARE_FILESYSTEM_ERROR0();
+		}
+	#endif //#ifdef FS_POSIX_
+}
+
+inline void sync_file(native_file_t handle)
+{
+	#ifdef FS_WINDOWS_
+		if (0 == FlushFileBuffers(handle))
+		{
+			GENERARE_FILESYSTEM_ERROR0();
+		}
+	#endif //#ifdef FS_WINDOWS_
+	#ifdef FS_POSIX_
+		#ifdef FS_LINUX_
+			const int result = fdatasync(handle);
+		#else
+			const int result = fsync(handle);
+		#endif //#ifdef FS_LINUX_
+		if (result != 0)
+		{
+			GENERARE_FILESYSTEM_ERROR0();
+		}
+	#endif //#ifdef FS_POSIX_
+}
+} //namespace internal
+
+// A block of memory aligned for FileMode::Direct transfers.
+class aligned_buffer
+{
+	char*	memory;
+	size_t	length;
+
+	aligned_buffer(const aligned_buffer&);
+	aligned_buffer& operator=(const aligned_buffer&);
+
+public:
+	// alignment must be a power of two.
+	explicit aligned_buffer(size_t size, size_t alignment = 4096)
+		: memory(0)
+		, length(size)
+	{
+		#ifdef FS_WINDOWS_
+			memory = static_cast<char*>(_aligned_malloc(size, alignment));
+		#endif //#ifdef FS_WINDOWS_
+		#ifdef FS_POSIX_
+			void* block = 0;
+			if (posix_memalign(&block, (std::max)(alignment, sizeof(void*)), size) == 0)
+			{
+				memory = static_cast<char*>(block);
+			}
+		#endif //#ifdef FS_POSIX_
+		if ((memory == 0) && (size != 0))
+		{
+			throw std::bad_alloc();
+		}
+	}
+
+	#ifdef FS_CPP11_
+	aligned_buffer(aligned_buffer&& other) noexcept
+		: memory(other.memory)
+		, length(other.length)
+	{
+		other.memory = 0;
+		other.length = 0;
+	}
+	#endif //#ifdef FS_CPP11_
+
+	~aligned_buffer()
+	{
+		#ifdef FS_WINDOWS_
+			_aligned_free(memory);
+		#endif //#ifdef FS_WINDOWS_
+		#ifdef FS_POSIX_
+			free(memory);
+		#endif //#ifdef FS_POSIX_
+	}
+
+	char* data() const
+	{ return memory;}
+
+	size_t size() const
+	{ return length;}
+};
+
+// An open file read and written through the operating system directly, with
+// no stream, locale or sentry layers.  Sequential reads and writes can go
+// through a caller-supplied buffer (see set_buffer); the positioned (_at) and
+// vectored calls always go straight to the file.
+//
+// With FileMode::Direct the buffers, transfer sizes and file positions must be
+// multiples of the device block size: use an aligned_buffer whose size is a
+// multiple of 4096 with set_buffer.  A final partial buffer is written through
+// the page cache when it is flushed.
+class file
+{
+	internal::native_file_t	handle;
+	unsigned int			file_mode;
+	char*					buffer;
+	size_t					buffer_capacity;
+	size_t					buffer_size;		// pending writes, or data read ahead
+	size_t					buffer_offset;		// read-ahead data already consumed
+	bool					buffer_writing;
+
+	file(const file&);
+	file& operator=(const file&);
+
+	void flush_buffer()
+	{
+		if (!buffer_writing || (buffer_size == 0))
+		{
+			return;
+		}
+		const size_t pending = buffer_size;
+		buffer_size = 0;
+		if (((file_mode & FileMode::Direct) != 0) && (pending != buffer_capacity))
+		{
+			internal::write_file_cached(handle, buffer, pending, file_mode);
+		}
+		else
+		{
+			internal::write_file(handle, buffer, pending, 0);
+		}
+	}
+
+	// Brings the file position back to what the caller has consumed, and
+	// writes anything pending.
+	void settle()
+	{
+		if (buffer_writing)
+		{
+			flush_buffer();
+			return;
+		}
+		if (buffer_offset < buffer_size)
+		{
+			internal::seek_file(handle, -static_cast<long long>(buffer_size - buffer_offset), true);
+		}
+		buffer_size		= 0;
+		buffer_offset	= 0;
+	}
+
+public:
+	file()
+		: handle(internal::invalid_file)
+		, file_mode(0)
+		, buffer(0)
+		, buffer_capacity(0)
+		, buffer_size(0)
+		, buffer_offset(0)
+		, buffer_writing(false)
+	{
+	}
+
+	// mode is a mask of FileMode values; permissions apply to a new file on
+	// POSIX systems.
+	template <class T>
+	explicit file(const basic_path<T>& path, unsigned int mode = FileMode::Read, unsigned int permissions = 0666)
+		: handle(internal::invalid_file)
+		, file_mode(0)
+		, buffer(0)
+		, buffer_capacity(0)
+		, buffer_size(0)
+		, buffer_offset(0)
+		, buffer_writing(false)
+	{
+		open(path, mode, permissions);
+	}
+
+	#ifdef FS_CPP11_
+	file(file&& other) noexcept
+		: file()
+	{
+		swap(other);
+	}
+
+	file& operator=(file&& other) noexcept
+	{
+		swap(other);
+		return *this;
+	}
+	#endif //#ifdef FS_CPP11_
+
+	~file()
+	{
+		try
+		{
+			close();
+		}
+		catch (...)
 		{
-			for (;;)
-			{
-				nextDelimiter = path_.find('/', searchIndex);
-				if (nextDelimiter == string_t::npos)
-				{
-					string_t lastElem = path_.substr(searchIndex);
-					if (!lastElem.empty())
-					{
-						path_elems.push_back(lastElem);
-					}
-					break;
-				}
-				path_elems.push_back(path_.substr(searchIndex, nextDelimiter-searchIndex));
-				searchIndex = nextDelimiter+1;
-			}
 		}
+	}
 
-		// Path cleanup & final validity checks
+	template <class T>
+	void open(const basic_path<T>& path, unsigned int mode = FileMode::Read, unsigned int permissions = 0666)
+	{
+		internal::native_string_t npath;
+		internal::convert_string(path.to_portable_string(), npath);
+		internal::native_file_t opened = internal::open_file(npath, mode, permissions);
+		close();
+		handle		= opened;
+		file_mode	= mode;
+	}
 
-		// Validate environment variable members.  Ex: "$(PATH)"
+	// Writes anything pending and closes the file.  The buffer stays set.
+	void close()
+	{
+		if (handle == internal::invalid_file)
 		{
-			typename vecstr_t::iterator	it		= path_elems.begin();
-			typename vecstr_t::iterator	endIt	= path_elems.end();
-			for (; it!=endIt; ++it)
-			{
-				size_t dollarSignLocation = it->find('$');
-				if (dollarSignLocation != string_t::npos)
-				{
-					if ((dollarSignLocation != 0) ||			// '(' is not where we expect it.
-						(it->length() < 4) ||					// element is too short.  It can't hold "$(A)".
-						(it->find('$', 1) != string_t::npos) ||	// There's too many dollar signs.
-						(it->find('(') != 1) ||					// '(' is not where we expect it.
-						(it->find('(', 2) != string_t::npos) || // There's too many open parentheses.
-						(it->find(')') != it->length()-1))		// ')' is not where we expect it.
-					{
-						throw filesystem_error("Path element contains '$', but has invalid environment variable format", __FILE__, __LINE__, "", "");
-					}
-					// Everything is OK if we reach here.
-				}
-				else if ((it->find('(') != string_t::npos) ||
-						 (it->find('(') != string_t::npos))
-				{
-					throw filesystem_error("Path element contains parentheses, but has invalid environment variable format", __FILE__, __LINE__, "", "");
-				}
-			}
+			return;
 		}
-
-		// Remove "."
-		path_elems.erase(std::remove(path_elems.begin(), path_elems.end(), string_t(1, '.')), path_elems.end());
-		if (path_elems.size() == 0)
+		try
+		{
+			settle();
+		}
+		catch (...)
 		{
-			path_elems.push_back(string_t(1, '.')); // The path was something like "." or "././." indicating the current path.  We need to keep this.
+			internal::close_file(handle);
+			handle = internal::invalid_file;
+			throw;
 		}
+		internal::close_file(handle);
+		handle = internal::invalid_file;
+	}
 
-		// Remove "..".
-		remove_double_elipses();
+	bool is_open() const
+	{ return handle != internal::invalid_file;}
+
+	internal::native_file_t native_handle() const
+	{ return handle;}
+
+	// Buffers sequential reads and writes in [data, data + capacity), which
+	// must outlive its use by the file.  A null data turns buffering off.
+	void set_buffer(void* data, size_t capacity)
+	{
+		settle();
+		buffer			= static_cast<char*>(data);
+		buffer_capacity	= (data != 0) ? capacity : 0;
+		buffer_writing	= false;
+		if (buffer_capacity == 0)
+		{
+			buffer = 0;
+		}
 	}
 
-	void remove_double_elipses()
+	// Reads up to size bytes at the file position.  Returns fewer only at the
+	// end of the file.
+	size_t read(void* data, size_t size)
 	{
-		// This section is O(n^2) and could likely be optimized further.  But it works for now and is clear.
-		string_t	doubleElipses(2, '.'); // ".."
+		if (buffer == 0)
+		{
+			return internal::read_file(handle, data, size, 0);
+		}
+		if (buffer_writing)
+		{
+			flush_buffer();
+			buffer_writing = false;
+		}
 
-		bool isDone = false;
-		while (!isDone)
+		char* target = static_cast<char*>(data);
+		size_t done = 0;
+		while (done < size)
 		{
-			typename vecstr_t::iterator	endIt = path_elems.end();
-			typename vecstr_t::iterator	startIt = path_elems.begin();
-			if (drive_specified || unc_path || (!relative))
+			if (buffer_offset == buffer_size)
 			{
-				++startIt;
-			}
-			typename vecstr_t::iterator	prevIt	= startIt;
-			typename vecstr_t::iterator	it		= startIt;
-			if (it != endIt)
-			{
-				++it;
-				isDone = true;
-				while (it != endIt)
+				buffer_size		= 0;
+				buffer_offset	= 0;
+				if (((file_mode & FileMode::Direct) == 0) && ((size - done) >= buffer_capacity))
 				{
-					if ((*it == doubleElipses) &&
-						(*prevIt != doubleElipses) &&
-						((*prevIt)[0] != '$'))
-					{
-						path_elems.erase(prevIt, it+1);
-						isDone = false;
-						break;
-					}
-					prevIt = it;
-					++it;
+					return done + internal::read_file(handle, target + done, size - done, 0);
+				}
+				buffer_size = internal::read_file(handle, buffer, buffer_capacity, 0);
+				if (buffer_size == 0)
+				{
+					break;
 				}
 			}
+			const size_t count = (std::min)(size - done, buffer_size - buffer_offset);
+			memcpy(target + done, buffer + buffer_offset, count);
+			buffer_offset	+= count;
+			done			+= count;
 		}
+		return done;
 	}
 
-	const string_t& get_path_string() const
+	void write(const void* data, size_t size)
 	{
-		if (!path_string_valid)
+		if (buffer == 0)
 		{
-			size_t	elementCount = path_elems.size();
-			size_t	element = 1;
-
-			path_string = path_elems[0];
+			internal::write_file(handle, data, size, 0);
+			return;
+		}
+		if (!buffer_writing)
+		{
+			settle();
+			buffer_writing = true;
+		}
 
-			if ((elementCount > 1) && (!unc_path))
+		const char* source = static_cast<const char*>(data);
+		if (((file_mode & FileMode::Direct) == 0) && (size >= buffer_capacity))
+		{
+			flush_buffer();
+			internal::write_file(handle, source, size, 0);
+			return;
+		}
+		while (size != 0)
+		{
+			const size_t count = (std::min)(size, buffer_capacity - buffer_size);
+			memcpy(buffer + buffer_size, source, count);
+			buffer_size	+= count;
+			source		+= count;
+			size		-= count;
+			if (buffer_size == buffer_capacity)
 			{
-				if (!relative) // ex: "c:/" or "/"
-				{
-					path_string.append(path_elems[1]);
-					element = 2;
-				}
+				flush_buffer();
 			}
+		}
+	}
 
-			for (; element<elementCount; ++element)
-			{
-				path_string.append(string_t(1, '/'));
-				path_string.append(path_elems[element]);
-			}
+	// Reads up to size bytes at offset without moving the file position.
+	size_t read_at(void* data, size_t size, unsigned long long offset)
+	{
+		settle();
+		return internal::read_file(handle, data, size, &offset);
+	}
 
-			path_string_valid = true;
-		}
-		return path_string;
+	// Writes at offset without moving the file position.  On POSIX systems a
+	// file opened with FileMode::Append is written at its end regardless.
+	void write_at(const void* data, size_t size, unsigned long long offset)
+	{
+		settle();
+		internal::write_file(handle, data, size, &offset);
 	}
 
-	bool get_variable_id(const string_t& elem, string_t& varId) const
+	// Reads into each buffer in turn at the file position, in as few calls as
+	// possible.  Returns the bytes read.
+	size_t readv(const io_buffer* buffers, size_t count)
 	{
-		// assert(!elem.empty());
-		if (elem[0] == '$')
-		{
-			size_t elemSize = elem.size();
-			if ((elem[1] != '(') || (elem[elemSize-1] != ')'))
-			{
-				assert(false);  // we shouldn't get here.
-				throw filesystem_error("Assertion failure", __FILE__, __LINE__, "", "");
-			}
-			varId = elem.substr(2, elemSize-3);
-			return true;
-		}
-		return false;
+		settle();
+		return internal::transfer_buffers(handle, buffers, count, 0, false);
 	}
 
-	void directory_scan_subdirs_for_files_helper(const string_t& pattern, std::vector<basic_path>& results)
+	size_t readv_at(const io_buffer* buffers, size_t count, unsigned long long offset)
 	{
-		std::vector<basic_path> dir_results;
-		directory_get_files(pattern, dir_results);
-		
-		results.insert(results.end(), dir_results.begin(), dir_results.end());
-		
-		directory_get_subdirs(dir_results);
+		settle();
+		return internal::transfer_buffers(handle, buffers, count, &offset, false);
+	}
 
-		std::vector<basic_path>::iterator it	= dir_results.begin();
-		std::vector<basic_path>::iterator itEnd	= dir_results.end();
-		for (; it!=itEnd; ++it)
-		{
-			it->directory_scan_subdirs_for_files_helper(pattern, results);
-		}
+	void writev(const io_buffer* buffers, size_t count)
+	{
+		settle();
+		internal::transfer_buffers(handle, buffers, count, 0, true);
 	}
 
-public:
-	basic_path(const string_t& path_)
-		: path_string_valid(false)
-		, relative(true)
-		, drive_specified(false)
-		, unc_path(false)
+	void writev_at(const io_buffer* buffers, size_t count, unsigned long long offset)
 	{
-		initialize(path_);
+		settle();
+		internal::transfer_buffers(handle, buffers, count, &offset, true);
 	}
 
-	basic_path(const char_t* path_)
-		: path_string_valid(false)
-		, relative(true)
-		, drive_specified(false)
-		, unc_path(false)
+	void seek(unsigned long long offset)
 	{
-		initialize(string_t(path_));
+		settle();
+		internal::seek_file(handle, static_cast<long long>(offset), false);
 	}
 
-	basic_path(Initializer::Enum initializer)
-		: path_string_valid(false)
-		, relative(true)
-		, drive_specified(false)
-		, unc_path(false)
+	unsigned long long position()
 	{
-		switch (initializer)
-		{
-			case Initializer::CurrentWorkingDirectory:
-			{
-				string_t path;
-				internal::current_working_dir(path);
-				initialize(path);
-				break;
-			}
-			default:
-			{
-				throw filesystem_error("Invalid path initializer specified", __FILE__, __LINE__, "", "");
-			}
-		}
+		const unsigned long long native_position = internal::seek_file(handle, 0, true);
+		return buffer_writing ? (native_position + buffer_size) : (native_position - (buffer_size - buffer_offset));
 	}
 
-	basic_path& operator=(const string_t& path_string)
+	unsigned long long size()
 	{
-		basic_path newPath(path_string);
-		swap(newPath);
-		return *this;
+		flush_buffer();
+		return internal::file_size(handle);
 	}
 
-	basic_path& operator=(Initializer::Enum initializer)
+	void resize(unsigned long long new_size)
 	{
-		basic_path newPath(initializer);
-		swap(newPath);
-		return *this;
+		settle();
+		internal::resize_file(handle, new_size);
 	}
 
-	void swap(basic_path& other)
+	// Writes anything pending to the file.
+	void flush()
 	{
-		path_elems.swap(other.path_elems);
-		path_string.swap(other.path_string);
+		flush_buffer();
+	}
 
-		std::swap(path_string_valid,	other.path_string_valid);
-		std::swap(relative,				other.relative);
-		std::swap(drive_specified,		other.drive_specified);
-		std::swap(unc_path,				other.unc_path);
+	// Writes anything pending and waits for the data to reach the disk.
+	void sync()
+	{
+		flush_buffer();
+		internal::sync_file(handle);
 	}
 
-	basic_path operator/(const string_t& other)
+	void swap(file& other)
 	{
-		string_t temp = to_portable_string();
-		temp.append(string_t(1,'/')).append(other);
-		return basic_path(temp);
+		std::swap(handle, other.handle);
+		std::swap(file_mode, other.file_mode);
+		std::swap(buffer, other.buffer);
+		std::swap(buffer_capacity, other.buffer_capacity);
+		std::swap(buffer_size, other.buffer_size);
+		std::swap(buffer_offset, other.buffer_offset);
+		std::swap(buffer_writing, other.buffer_writing);
 	}
+};
+#endif // REGION: class file
 
-	basic_path operator/(const basic_path& other)
+#if 1 // REGION: async operations
+#ifdef FS_COROUTINES_
+class async_context;
+
+namespace internal
+{
+// Wakes the thread waiting for completions: an eventfd on Linux, which
+// io_uring can signal itself, a pipe on other POSIX systems and an event on
+// Windows.
+class async_notifier
+{
+	native_file_t	read_handle;
+	native_file_t	write_handle;
+
+	async_notifier(const async_notifier&);
+	async_notifier& operator=(const async_notifier&);
+
+public:
+	async_notifier()
+		: read_handle(invalid_file)
+		, write_handle(invalid_file)
 	{
-		return operator/(other.to_portable_string());
+		#ifdef FS_WINDOWS_
+			HANDLE event = CreateEventW(NULL, TRUE, FALSE, NULL);
+			if (event == NULL)
+			{
+				GENERARE_FILESYSTEM_ERROR0();
+			}
+			read_handle = write_handle = event;
+		#endif //#ifdef FS_WINDOWS_
+		#ifdef FS_POSIX_
+			#ifdef FS_LINUX_
+				read_handle = write_handle = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+				if (read_handle == -1)
+				{
+					GENERARE_FILESYSTEM_ERROR0();
+				}
+			#else
+				int fds[2];
+				if (pipe(fds) != 0)
+				{
+					GENERARE_FILESYSTEM_ERROR0();
+				}
+				for (int i=0; i<2; ++i)
+				{
+					fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+					fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+				}
+				read_handle		= fds[0];
+				write_handle	= fds[1];
+			#endif //#ifdef FS_LINUX_
+		#endif //#ifdef FS_POSIX_
 	}
 
-	basic_path& operator/=(const string_t& other)
+	~async_notifier()
 	{
-		basic_path newPath = operator/(other);
-		swap(newPath);
-		return *this;
+		close_file(read_handle);
+		if (write_handle != read_handle)
+		{
+			close_file(write_handle);
+		}
 	}
 
-	basic_path& operator/=(const basic_path& other)
+	native_file_t handle() const
 	{
-		basic_path newPath = operator/(other);
-		swap(newPath);
-		return *this;
+		return read_handle;
 	}
 
-	basic_path& append(const string_t& other)
+	void signal()
 	{
-		return (*this)/= other;
+		#ifdef FS_WINDOWS_
+			SetEvent(write_handle);
+		#endif //#ifdef FS_WINDOWS_
+		#ifdef FS_POSIX_
+			#ifdef FS_LINUX_
+				const unsigned long long one = 1;
+				ssize_t written = ::write(write_handle, &one, sizeof(one));
+			#else
+				const char one = 1;
+				ssize_t written = ::write(write_handle, &one, sizeof(one));	// a full pipe is signaled already
+			#endif //#ifdef FS_LINUX_
+			(void)written;
+		#endif //#ifdef FS_POSIX_
 	}
 
-	basic_path& append(const basic_path& other)
+	void clear()
 	{
-		return (*this)/= other;
+		#ifdef FS_WINDOWS_
+			ResetEvent(read_handle);
+		#endif //#ifdef FS_WINDOWS_
+		#ifdef FS_POSIX_
+			char drained[64];
+			while (::read(read_handle, drained, sizeof(drained)) > 0)
+			{
+			}
+		#endif //#ifdef FS_POSIX_
 	}
 
-	bool is_relative() const
+	void wait() const
 	{
-		return relative;
+		#ifdef FS_WINDOWS_
+			WaitForSingleObject(read_handle, INFINITE);
+		#endif //#ifdef FS_WINDOWS_
+		#ifdef FS_POSIX_
+			struct pollfd readable;
+			readable.fd			= read_handle;
+			readable.events		= POLLIN;
+			readable.revents	= 0;
+			while ((::poll(&readable, 1, -1) == -1) && (errno == EINTR))
+			{
+			}
+		#endif //#ifdef FS_POSIX_
 	}
+};
 
-	bool is_drive_specified() const
+#ifdef FS_IO_URING_
+// The exception the synchronous calls would throw for error.
+inline std::exception_ptr filesystem_error_ptr(int error, const std::string& path)
+{
+	try
 	{
-		return drive_specified;
+		errno = error;
+		GENERARE_FILESYSTEM_ERROR1(path);
+	}
+	catch (...)
+	{
+		return std::current_exception();
 	}
+	return std::exception_ptr();
+}
+#endif //#ifdef FS_IO_URING_
 
-	bool is_unc_path() const
+// The state of one awaited operation, kept in the awaiting coroutine's frame.
+// With io_uring the operation is carried out as a series of requests, each
+// submitted by prepare() and handed its result by complete(); otherwise run()
+// does all of it on a worker thread.
+class async_operation
+{
+	async_operation(const async_operation&);
+	async_operation& operator=(const async_operation&);
+
+protected:
+	void rethrow() const
 	{
-		return unc_path;
+		if (error)
+		{
+			std::rethrow_exception(error);
+		}
 	}
 
-	bool exists() const
+public:
+	async_context&			context;
+	std::coroutine_handle<>	waiter;
+	std::exception_ptr		error;
+
+	explicit async_operation(async_context& context_)
+		: context(context_)
 	{
-		return internal::exists(get_path_string());
 	}
 
-	bool is_file() const
+	virtual ~async_operation()
 	{
-		return internal::is_file(get_path_string());
 	}
 
-	bool is_directory() const
+	// False for operations io_uring has no requests for.
+	virtual bool uses_ring() const
 	{
-		return internal::is_directory(get_path_string());
+		return true;
 	}
 
-	bool is_directory_empty() const
+	#ifdef FS_IO_URING_
+	virtual void prepare(io_uring_sqe*)
 	{
-		return internal::is_directory_empty(get_path_string());
 	}
 
-	const string_t to_portable_string() const
+	// Returns true once the operation is done, false to submit the next request.
+	virtual bool complete(int)
 	{
-		return get_path_string();
+		return true;
 	}
+	#endif //#ifdef FS_IO_URING_
 
-	string_t to_win32_string() const
+	virtual void run() = 0;
+
+	bool await_ready() const noexcept
 	{
-		string_t					win23_str	= get_path_string();
-		typename string_t::iterator it			= win23_str.begin();
-		typename string_t::iterator itEnd		= win23_str.end();
-		for (; it!=itEnd; ++it)
+		return false;
+	}
+
+	void await_suspend(std::coroutine_handle<> waiter_);
+};
+} //namespace internal
+
+// Carries out the async_* operations for coroutines running on one thread,
+// typically an event loop's.  Operations go to io_uring where available and
+// to a pool of worker threads otherwise (and always, for directory scans).
+// Awaiting coroutines are resumed only from poll() and run_one(), on the
+// thread calling them, so they never run concurrently with one another.
+//
+// An event loop can watch notify_handle(), which becomes readable (signaled
+// on Windows) when poll() has coroutines to resume.  A coroutine must not be
+// destroyed while it awaits an operation.
+class async_context
+{
+	friend class internal::async_operation;
+
+	internal::async_notifier				notifier;
+	#ifdef FS_IO_URING_
+		std::unique_ptr<internal::io_ring>		ring;
+		unsigned int							ring_in_flight;
+		std::deque<internal::async_operation*>	ring_backlog;	// waiting for room in the ring
+	#endif //#ifdef FS_IO_URING_
+	unsigned int							thread_count;
+	std::vector<std::thread>				threads;
+	std::mutex								lock;
+	std::condition_variable					work_ready;
+	std::deque<internal::async_operation*>	work;
+	std::deque<internal::async_operation*>	finished;
+	bool									stopping;
+	size_t									outstanding;
+
+	async_context(const async_context&);
+	async_context& operator=(const async_context&);
+
+	void work_loop()
+	{
+		for (;;)
 		{
-			if (*it == '/')
+			internal::async_operation* op;
 			{
-				*it = '\\';
+				std::unique_lock<std::mutex> guard(lock);
+				work_ready.wait(guard, [this]() { return stopping || !work.empty(); });
+				if (stopping)
+				{
+					return;
+				}
+				op = work.front();
+				work.pop_front();
 			}
+			try
+			{
+				op->run();
+			}
+			catch (...)
+			{
+				op->error = std::current_exception();
+			}
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				finished.push_back(op);
+			}
+			notifier.signal();
 		}
-		return win23_str;
 	}
 
-	basic_path full_path() const
+	#ifdef FS_IO_URING_
+	void submit_request(internal::async_operation* op)
 	{
-		string_t temp_path_string;
+		io_uring_sqe* sqe = ring->get_sqe();
+		op->prepare(sqe);
+		sqe->user_data = reinterpret_cast<unsigned long long>(op);
+		if (!ring->submit(0))
+		{
+			ring->withdraw();
+			throw filesystem_error("Failed to submit io_uring requests", __FILE__, __LINE__, "", "");
+		}
+		++ring_in_flight;
+	}
+	#endif //#ifdef FS_IO_URING_
 
-		#ifdef FS_WINDOWS_
-			if (drive_specified & relative)
+	// Counts op as outstanding only once it is queued: if starting it throws,
+	// the exception resumes the awaiting coroutine instead.
+	void start(internal::async_operation* op)
+	{
+		#ifdef FS_IO_URING_
+			if (ring && op->uses_ring())
 			{
-				temp_path_string = internal::cur_drive_path(path_elems[0]);
-				size_t elements = path_elems.size();
-				if (elements > 0)
+				if (ring_in_flight < ring->capacity())
 				{
-					size_t lastIndex = temp_path_string.length() - 1;
-					if ((temp_path_string[lastIndex] != '/') &&
-						(temp_path_string[lastIndex] != '\\'))
+					submit_request(op);
+				}
+				else
+				{
+					ring_backlog.push_back(op);
+				}
+				++outstanding;
+				return;
+			}
+		#endif //#ifdef FS_IO_URING_
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			if (threads.empty())
+			{
+				try
+				{
+					for (unsigned int i=0; i<thread_count; ++i)
 					{
-						temp_path_string.push_back('/');
-					}
-
-					temp_path_string.append(path_elems[1]);
-					for (size_t elem=2; elem<elements; ++elem)
+						threads.push_back(std::thread(&async_context::work_loop, this));
+					}
+				}
+				catch (...)
+				{
+					if (threads.empty())
 					{
-						temp_path_string.push_back('/');
-						temp_path_string.append(path_elems[elem]);
+						throw;
 					}
 				}
 			}
-			else
-		#endif //#ifdef FS_WINDOWS_
-			{
-				temp_path_string = to_portable_string();
-			}
-		return basic_path(internal::full_pathname(temp_path_string));
+			work.push_back(op);
+		}
+		++outstanding;
+		work_ready.notify_one();
 	}
 
-	basic_path from(const basic_path& other) const
+public:
+	// Up to queue_depth io_uring requests are kept in flight; thread_count
+	// worker threads (0 for one per core) are started when first needed.
+	explicit async_context(unsigned int queue_depth = 128, unsigned int thread_count_ = 0)
+		: thread_count(thread_count_)
+		, stopping(false)
+		, outstanding(0)
 	{
-		basic_path thisFullPath = full_path();
-		basic_path otherFullPath = other.full_path();
-
-		if (!internal::compare_path_element(thisFullPath.path_elems[0], otherFullPath.path_elems[0]))
+		if (thread_count == 0)
 		{
-			//we have paths with different roots.  Return the other full path.
-			return thisFullPath;
+			thread_count = (std::max)(std::thread::hardware_concurrency(), 1u);
 		}
-		// We have similar paths, we can reach one path from the other.
-		size_t thisPathElems		= thisFullPath.path_elems.size();
-		size_t otherPathElems		= otherFullPath.path_elems.size();
-		size_t maxSimilarElems		= (thisPathElems < otherPathElems) ? thisPathElems : otherPathElems;
-		size_t differentElemIndex	= maxSimilarElems+1;
-		for (size_t elem=1; elem<maxSimilarElems; ++elem)
-		{
-			if (!internal::compare_path_element(thisFullPath.path_elems[elem], otherFullPath.path_elems[elem]))
+		#ifdef FS_IO_URING_
+			ring_in_flight = 0;
+			ring.reset(new internal::io_ring(queue_depth));
+			if (!ring->valid() || !ring->register_eventfd(notifier.handle()))
 			{
-				differentElemIndex = elem;
-				break;
+				ring.reset();
 			}
-		}
+		#else
+			(void)queue_depth;
+		#endif //#ifdef FS_IO_URING_
+	}
 
-		string_t newPathString;
-		for (size_t elem=differentElemIndex; elem<otherPathElems; ++elem)
+	// Operations still in flight are abandoned; their coroutines are never
+	// resumed.
+	~async_context()
+	{
 		{
-			newPathString.push_back('.');
-			newPathString.push_back('.');
-			newPathString.push_back('/');
+			std::lock_guard<std::mutex> guard(lock);
+			stopping = true;
 		}
-		for (size_t elem=differentElemIndex; elem<thisPathElems; ++elem)
+		work_ready.notify_all();
+		for (size_t i=0; i<threads.size(); ++i)
 		{
-			newPathString.append(thisFullPath.path_elems[elem]);
-			newPathString.push_back('/');
+			threads[i].join();
 		}
-		//newPathString.erase(newPathString.end()-1);
-		return basic_path(newPathString);
 	}
 
-	basic_path from(const string_t& other) const
+	// The context of the calling thread, used by the async_* overloads that
+	// don't take one.
+	static async_context& this_thread()
 	{
-		return from(basic_path(other));
+		static thread_local async_context context;
+		return context;
 	}
 
-	basic_path to(const basic_path& other) const
+	internal::native_file_t notify_handle() const
 	{
-		return other.from(*this);
+		return notifier.handle();
 	}
 
-	basic_path to(const string_t& other) const
+	// Operations started and not yet resumed.
+	size_t pending() const
 	{
-		return basic_path(other).from(*this);
+		return outstanding;
 	}
 
-	basic_path apply_variables(const std::map<string_t, string_t>& varmap) const
+	// Resumes the coroutines whose operations have finished, without waiting.
+	// Returns the number resumed.
+	size_t poll()
 	{
-		typename std::map<string_t, string_t>::const_iterator it;
-
-		size_t		elemCount = path_elems.size();
-		size_t		elem = 0;
-		string_t	newPathString;
-		string_t	varId;
+		notifier.clear();
+		std::vector<internal::async_operation*> done;
 
-		if (!relative)
-		{
-			newPathString = path_elems[0];
-		}
-		else
-		{
-			if (get_variable_id(path_elems[0], varId) &&
-				((it = varmap.find(varId)) != varmap.end()))
+		#ifdef FS_IO_URING_
+			if (ring)
 			{
-				newPathString = it->second;
-				char_t lastChar = *(newPathString.end()-1);
-				if ((lastChar != '/') && (lastChar != '\\'))
+				unsigned long long	user_data;
+				int					result;
+				while (ring->next_completion(user_data, result))
 				{
-					newPathString.push_back('/');
+					--ring_in_flight;
+					internal::async_operation* op = reinterpret_cast<internal::async_operation*>(user_data);
+					bool complete = true;
+					try
+					{
+						complete = op->complete(result);
+						if (!complete)
+						{
+							submit_request(op);
+						}
+					}
+					catch (...)
+					{
+						op->error	= std::current_exception();
+						complete	= true;
+					}
+					if (complete)
+					{
+						done.push_back(op);
+					}
 				}
-			}
-			else
-			{
-				newPathString = path_elems[0];
-				newPathString.push_back('/');
-			}
-		}
-
-		for (elem=1; elem<elemCount; ++elem)
-		{
-			if (get_variable_id(path_elems[elem], varId) &&
-				((it = varmap.find(varId)) != varmap.end()))
-			{
-				newPathString.append(it->second);
-				char_t lastChar = *(newPathString.end()-1);
-				if ((lastChar != '/') && (lastChar != '\\'))
+				while (!ring_backlog.empty() && (ring_in_flight < ring->capacity()))
 				{
-					newPathString.push_back('/');
+					internal::async_operation* op = ring_backlog.front();
+					ring_backlog.pop_front();
+					try
+					{
+						submit_request(op);
+					}
+					catch (...)
+					{
+						op->error = std::current_exception();
+						done.push_back(op);
+					}
 				}
 			}
-			else
-			{
-				newPathString.append(path_elems[elem]);
-				newPathString.push_back('/');
-			}
+		#endif //#ifdef FS_IO_URING_
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			done.insert(done.end(), finished.begin(), finished.end());
+			finished.clear();
 		}
 
-		return basic_path(newPathString);
+		for (size_t i=0; i<done.size(); ++i)
+		{
+			--outstanding;
+			done[i]->waiter.resume();
+		}
+		return done.size();
 	}
 
-	bool operator==(const basic_path& other) const
+	// Waits until at least one operation has finished, then resumes as poll()
+	// does.  Returns 0 at once if nothing is pending.
+	size_t run_one()
 	{
-		size_t elems = path_elems.size();
-		if (elems != other.path_elems.size())
-		{
-			return false;
-		}
-		for (size_t elem=0; elem<elems; ++elem)
+		for (;;)
 		{
-			if (!internal::compare_path_element(path_elems[elem], other.path_elems[elem]))
+			const size_t resumed = poll();
+			if ((resumed != 0) || (outstanding == 0))
 			{
-				return false;
+				return resumed;
 			}
+			notifier.wait();
 		}
-		return true;
 	}
 
-	bool operator!=(const basic_path& other) const
+	// Resumes coroutines until no operation is pending.
+	void run()
 	{
-		return !operator==(other);
+		while (outstanding != 0)
+		{
+			run_one();
+		}
 	}
+};
 
-	string_t filename() const
-	{
-		return *(path_elems.end()-1);
-	}
+namespace internal
+{
+inline void async_operation::await_suspend(std::coroutine_handle<> waiter_)
+{
+	waiter = waiter_;
+	context.start(this);
+}
 
-	string_t stem() const
+class async_status_operation : public async_operation
+{
+	native_string_t	path;
+	bool			follow_links;
+	file_status		result;
+	#ifdef FS_IO_URING_
+		struct statx	buffer;
+	#endif //#ifdef FS_IO_URING_
+
+public:
+	async_status_operation(async_context& context_, const native_string_t& path_, bool follow_links_)
+		: async_operation(context_)
+		, path(path_)
+		, follow_links(follow_links_)
 	{
-		string_t temp = *(path_elems.end()-1);
-		return temp.substr(0, temp.find_last_of('.'));
 	}
 
-	string_t extension() const
+	#ifdef FS_IO_URING_
+	virtual void prepare(io_uring_sqe* sqe)
 	{
-		string_t temp = *(path_elems.end()-1);
-		return temp.substr(temp.find_last_of('.')+1);
+		sqe->opcode			= IORING_OP_STATX;
+		sqe->fd				= AT_FDCWD;
+		sqe->addr			= reinterpret_cast<unsigned long long>(path.c_str());
+		sqe->len			= statx_mask(EntryField::All);
+		sqe->off			= reinterpret_cast<unsigned long long>(&buffer);
+		sqe->statx_flags	= follow_links ? 0 : AT_SYMLINK_NOFOLLOW;
 	}
 
-	void directory_get_files(std::vector<string_t>& results)
+	virtual bool complete(int code)
 	{
-		if (!this->is_directory())
+		if (code == 0)
 		{
-			throw filesystem_error("Specified path is not a directory.", __FILE__, __LINE__, "", "");
+			result = status_from_statx(buffer);
 		}
-		internal::dir_get_files(to_portable_string(), string_t(), results);
+		else if (code == -EINVAL)
+		{
+			// The kernel predates IORING_OP_STATX.
+			run();
+		}
+		else if ((code != -ENOENT) && (code != -ENOTDIR))
+		{
+			error = filesystem_error_ptr(-code, path);
+		}
+		return true;
 	}
+	#endif //#ifdef FS_IO_URING_
 
-	void directory_get_files(const string_t& pattern, std::vector<string_t>& results)
+	virtual void run()
 	{
-		if (!this->is_directory())
-		{
-			throw filesystem_error("Specified path is not a directory.", __FILE__, __LINE__, "", "");
-		}
-		internal::dir_get_files(to_portable_string(), pattern, results);
+		result = get_status(path, follow_links);
 	}
 
-	void directory_get_files(const string_t& pattern, std::vector<basic_path>& results)
+	file_status await_resume() const
 	{
-		basic_path				fullpath = full_path(); 
-		std::vector<string_t>	str_results;
+		rethrow();
+		return result;
+	}
+};
 
-		fullpath.directory_get_files(pattern, str_results);
-		results.clear();
+// Opens the file, then reads or writes it in as many requests as it takes.
+class async_transfer_operation : public async_operation
+{
+	native_string_t		path;
+	char*				buffer;
+	size_t				size;
+	unsigned long long	offset;
+	unsigned int		mode;
+	size_t				done;
+	#ifdef FS_IO_URING_
+		int				fd;
+		size_t			requested;
+	#endif //#ifdef FS_IO_URING_
+
+	bool writing() const
+	{
+		return (mode & FileMode::Write) != 0;
+	}
 
-		std::vector<string_t>::iterator it		= str_results.begin();
-		std::vector<string_t>::iterator itEnd	= str_results.end();
-		for (; it!=itEnd; ++it)
-		{
-			results.push_back(fullpath / *it);
-		}
+public:
+	async_transfer_operation(async_context& context_, const native_string_t& path_, char* buffer_, size_t size_, unsigned long long offset_, unsigned int mode_)
+		: async_operation(context_)
+		, path(path_)
+		, buffer(buffer_)
+		, size(size_)
+		, offset(offset_)
+		, mode(mode_)
+		, done(0)
+		#ifdef FS_IO_URING_
+		, fd(-1)
+		, requested(0)
+		#endif //#ifdef FS_IO_URING_
+	{
 	}
 
-	void directory_get_files(std::vector<basic_path>& results)
+	~async_transfer_operation()
 	{
-		directory_get_files(string_t(), results);
+		#ifdef FS_IO_URING_
+			if (fd != -1)
+			{
+				::close(fd);
+			}
+		#endif //#ifdef FS_IO_URING_
 	}
 
-	void directory_get_subdirs(std::vector<string_t>& results)
+	#ifdef FS_IO_URING_
+	virtual void prepare(io_uring_sqe* sqe)
 	{
-		if (!this->is_directory())
+		if (fd == -1)
 		{
-			throw filesystem_error("Specified path is not a directory.", __FILE__, __LINE__, "", "");
+			sqe->opcode		= IORING_OP_OPENAT;
+			sqe->fd			= AT_FDCWD;
+			sqe->addr		= reinterpret_cast<unsigned long long>(path.c_str());
+			sqe->open_flags	= open_flags(mode);
+			sqe->len		= 0666;
+			return;
 		}
-		internal::dir_get_subdirs(to_portable_string(), string_t(), results);
+		requested		= (std::min)(size - done, static_cast<size_t>(0x40000000));
+		sqe->opcode		= writing() ? IORING_OP_WRITE : IORING_OP_READ;
+		sqe->fd			= fd;
+		sqe->addr		= reinterpret_cast<unsigned long long>(buffer + done);
+		sqe->len		= static_cast<unsigned int>(requested);
+		sqe->off		= offset + done;
 	}
 
-	void directory_get_subdirs(const string_t& pattern, std::vector<string_t>& results)
+	virtual bool complete(int code)
 	{
-		if (!this->is_directory())
+		if ((code == 0) && writing() && (fd != -1))
 		{
-			throw filesystem_error("Specified path is not a directory.", __FILE__, __LINE__, "", "");
+			code = -EIO;
 		}
-		internal::dir_get_subdirs(to_portable_string(), pattern, results);
+		if (code < 0)
+		{
+			error = filesystem_error_ptr(-code, path);
+			return true;
+		}
+		if (fd == -1)
+		{
+			fd = code;
+			return (size == 0);
+		}
+		done += static_cast<size_t>(code);
+		// A short read from a regular file means the end of it.
+		return (done == size) || (!writing() && (static_cast<size_t>(code) < requested));
 	}
+	#endif //#ifdef FS_IO_URING_
 
-	void directory_get_subdirs(const string_t& pattern, std::vector<basic_path>& results)
+	virtual void run()
 	{
-		basic_path				fullpath = full_path(); 
-		std::vector<string_t>	str_results;
-
-		fullpath.directory_get_subdirs(pattern, str_results);
-		results.clear();
-
-		std::vector<string_t>::iterator it		= str_results.begin();
-		std::vector<string_t>::iterator itEnd	= str_results.end();
-		for (; it!=itEnd; ++it)
+		native_file_t handle = open_file(path, mode, 0666);
+		try
+		{
+			if (writing())
+			{
+				write_file(handle, buffer, size, &offset);
+				done = size;
+			}
+			else
+			{
+				done = read_file(handle, buffer, size, &offset);
+			}
+		}
+		catch (...)
 		{
-			results.push_back(fullpath / *it);
+			close_file(handle);
+			throw;
 		}
+		close_file(handle);
 	}
 
-	void directory_get_subdirs(std::vector<basic_path>& results)
+	// The bytes transferred.
+	size_t await_resume() const
 	{
-		directory_get_subdirs(string_t(), results);
+		rethrow();
+		return done;
 	}
+};
 
-	void directory_scan_subdirs_for_files(const string_t& pattern, std::vector<basic_path>& results)
+// There are no io_uring requests for reading directories; scans always run
+// on a worker thread.
+template<class T>
+class async_scan_operation : public async_operation
+{
+	basic_path<T>							dir;
+	std::basic_string<T>					pattern;
+	unsigned int							fields;
+	std::vector<basic_directory_entry<T> >	result;
+
+public:
+	async_scan_operation(async_context& context_, const basic_path<T>& dir_, const std::basic_string<T>& pattern_, unsigned int fields_)
+		: async_operation(context_)
+		, dir(dir_)
+		, pattern(pattern_)
+		, fields(fields_)
 	{
-		results.clear();
-		directory_scan_subdirs_for_files_helper(pattern, results);
 	}
 
-	void directory_scan_subdirs_for_files(std::vector<basic_path>& results)
+	virtual bool uses_ring() const
 	{
-		results.clear();
-		directory_scan_subdirs_for_files_helper(string_t(), results);
+		return false;
 	}
 
-#ifdef FS_WINDOWS_
-	bool is_junction_point() const
+	virtual void run()
 	{
-		return internal::is_junction_point(get_path_string());
+		std::vector<basic_directory_entry<T> > subdirs;
+		dir.directory_get_files(pattern, result, fields);
+		dir.directory_get_subdirs(pattern, subdirs, fields);
+		result.insert(result.end(), subdirs.begin(), subdirs.end());
+	}
+
+	std::vector<basic_directory_entry<T> > await_resume()
+	{
+		rethrow();
+		return std::move(result);
 	}
-#endif //#ifdef FS_WINDOWS_
 };
-#endif // REGION: class basic_path
+} //namespace internal
+
+// co_await async_read(...) reads up to size bytes of path at offset into
+// buffer and produces the number read, which is less than size only at the
+// end of the file.
+template <class T>
+internal::async_transfer_operation async_read(async_context& context, const basic_path<T>& path, void* buffer, size_t size, unsigned long long offset = 0)
+{
+	internal::native_string_t npath;
+	internal::convert_string(path.to_portable_string(), npath);
+	return internal::async_transfer_operation(context, npath, static_cast<char*>(buffer), size, offset, FileMode::Read);
+}
+
+template <class T>
+internal::async_transfer_operation async_read(const basic_path<T>& path, void* buffer, size_t size, unsigned long long offset = 0)
+{
+	return async_read(async_context::this_thread(), path, buffer, size, offset);
+}
+
+// co_await async_write(...) writes size bytes of data to path at offset.
+// mode is a mask of FileMode values; Write is implied.
+template <class T>
+internal::async_transfer_operation async_write(async_context& context, const basic_path<T>& path, const void* data, size_t size, unsigned long long offset = 0,
+											  unsigned int mode = FileMode::Write | FileMode::Create | FileMode::Truncate)
+{
+	internal::native_string_t npath;
+	internal::convert_string(path.to_portable_string(), npath);
+	return internal::async_transfer_operation(context, npath, static_cast<char*>(const_cast<void*>(data)), size, offset, mode | FileMode::Write);
+}
+
+template <class T>
+internal::async_transfer_operation async_write(const basic_path<T>& path, const void* data, size_t size, unsigned long long offset = 0,
+											  unsigned int mode = FileMode::Write | FileMode::Create | FileMode::Truncate)
+{
+	return async_write(async_context::this_thread(), path, data, size, offset, mode);
+}
+
+// co_await async_status(...) produces the file_status of path; a missing path
+// has type FileType::NotFound.
+template <class T>
+internal::async_status_operation async_status(async_context& context, const basic_path<T>& path, bool follow_links = true)
+{
+	internal::native_string_t npath;
+	internal::convert_string(path.to_portable_string(), npath);
+	return internal::async_status_operation(context, npath, follow_links);
+}
+
+template <class T>
+internal::async_status_operation async_status(const basic_path<T>& path, bool follow_links = true)
+{
+	return async_status(async_context::this_thread(), path, follow_links);
+}
+
+// co_await async_scan(...) produces the files, then the subdirectories, of
+// dir matching pattern (all of them if empty), with the metadata selected by
+// fields (a mask of EntryField values).
+template <class T>
+internal::async_scan_operation<T> async_scan(async_context& context, const basic_path<T>& dir, const std::basic_string<T>& pattern = std::basic_string<T>(), unsigned int fields = EntryField::Basic)
+{
+	return internal::async_scan_operation<T>(context, dir, pattern, fields);
+}
+
+template <class T>
+internal::async_scan_operation<T> async_scan(const basic_path<T>& dir, const std::basic_string<T>& pattern = std::basic_string<T>(), unsigned int fields = EntryField::Basic)
+{
+	return async_scan(async_context::this_thread(), dir, pattern, fields);
+}
+#endif //#ifdef FS_COROUTINES_
+#endif // REGION: async operations
 
 #if 1 // REGION: free filesystem functions
 
@@ -2263,6 +9238,30 @@ void create_directory(const basic_path<T>& dir)
 	internal::create_directory(dir.to_portable_string());
 }
 
+// Creates dir along with any missing parents (like "mkdir -p"), and returns
+// the number of directories created.  A directory that already exists, even
+// one created concurrently by another process, is not an error.
+template <class T>
+size_t create_directories(const basic_path<T>& dir)
+{
+	internal::native_string_t ndir;
+	internal::convert_string(dir.to_portable_string(), ndir);
+	return internal::create_directories(ndir, 0);
+}
+
+// Creates several directories with their missing parents, creating the
+// parents they share once.
+template <class T>
+size_t create_directories(const std::vector<basic_path<T> >& dirs)
+{
+	std::vector<internal::native_string_t> ndirs(dirs.size());
+	for (size_t i=0; i<dirs.size(); ++i)
+	{
+		internal::convert_string(dirs[i].to_portable_string(), ndirs[i]);
+	}
+	return internal::create_directories(ndirs);
+}
+
 template <class T>
 void remove_directory(const basic_path<T>& dir)
 {
@@ -2275,6 +9274,17 @@ void remove_file(const basic_path<T>& dir)
 	internal::remove_file(dir.to_portable_string());
 }
 
+// Removes path and, if it is a directory, everything below it, without
+// following symbolic links.  Returns the number of files and directories
+// removed, including path itself; a missing path removes nothing.  Separate
+// subtrees are removed in parallel on thread_count threads (0 for one per
+// core, 1 for a sequential walk).
+template <class T>
+size_t remove_all(const basic_path<T>& path, unsigned int thread_count = 0)
+{
+	return internal::remove_all(path.to_portable_string(), thread_count);
+}
+
 template <class T>
 void move(const basic_path<T>& oldpath, const basic_path<T>& newpath)
 {
@@ -2287,17 +9297,47 @@ void create_hard_link(const basic_path<T>& link, const basic_path<T>& source)
 	internal::create_hard_link(link.to_portable_string(), source.to_portable_string());
 }
 
+// Copies the regular file from to to.  The data is cloned (reflinked) where
+// the file system supports it, and otherwise copied inside the kernel
+// (copy_file_range, then sendfile) before falling back to read/write.
+// options is a mask of CopyOption values.
+template <class T>
+void copy_file(const basic_path<T>& from, const basic_path<T>& to, unsigned int options = CopyOption::None)
+{
+	internal::copy_file(from.to_portable_string(), to.to_portable_string(), options);
+}
+
+// Fills results[i] with the status of paths[i].  On Linux up to queue_depth
+// statx requests are kept in flight through io_uring; where io_uring isn't
+// available, up to queue_depth threads (at most a few per core) stat the
+// paths.  Missing paths are reported as FileType::NotFound.  Any other failure is thrown once the
+// batch has finished.
+template <class T>
+void batch_status(const std::vector<basic_path<T> >& paths, std::vector<file_status>& results, bool follow_links = true, unsigned int queue_depth = 128)
+{
+	std::vector<internal::native_string_t> native_paths(paths.size());
+	for (size_t index=0; index<paths.size(); ++index)
+	{
+		internal::convert_string(paths[index].to_portable_string(), native_paths[index]);
+	}
+	internal::batch_status(native_paths, follow_links, queue_depth, results);
+}
+
 template <class T>
 std::fstream open_fstream(const basic_path<T>& filename, std::ios_base::openmode mode = std::ios_base::in | std::ios_base::out)
 {
 	return std::fstream(filename.to_portable_string().c_str(), mode);
 }
 
+// The protection overloads take a share flag (_SH_DENYWR and so on), which
+// only Microsoft's library supports.
+#ifdef _MSC_VER
 template <class T>
 std::fstream open_fstream(const basic_path<T>& filename, std::ios_base::openmode mode, int protection)
 {
 	return std::fstream(filename.to_portable_string().c_str(), mode, protection);
 }
+#endif //#ifdef _MSC_VER
 
 template <class T>
 std::wfstream open_wfstream(const basic_path<T>& filename, std::ios_base::openmode mode = std::ios_base::in | std::ios_base::out)
@@ -2305,11 +9345,13 @@ std::wfstream open_wfstream(const basic_path<T>& filename, std::ios_base::openmo
 	return std::wfstream(filename.to_portable_string().c_str(), mode);
 }
 
+#ifdef _MSC_VER
 template <class T>
 std::wfstream open_wfstream(const basic_path<T>& filename, std::ios_base::openmode mode, int protection)
 {
 	return std::wfstream(filename.to_portable_string().c_str(), mode, protection);
 }
+#endif //#ifdef _MSC_VER
 
 template <class T>
 std::ifstream open_ifstream(const basic_path<T>& filename, std::ios_base::openmode mode = std::ios_base::in)
@@ -2317,11 +9359,13 @@ std::ifstream open_ifstream(const basic_path<T>& filename, std::ios_base::openmo
 	return std::ifstream(filename.to_portable_string().c_str(), mode);
 }
 
+#ifdef _MSC_VER
 template <class T>
 std::ifstream open_ifstream(const basic_path<T>& filename, std::ios_base::openmode mode, int protection)
 {
 	return std::ifstream(filename.to_portable_string().c_str(), mode, protection);
 }
+#endif //#ifdef _MSC_VER
 
 template <class T>
 std::wifstream open_wifstream(const basic_path<T>& filename, std::ios_base::openmode mode = std::ios_base::in)
@@ -2329,11 +9373,13 @@ std::wifstream open_wifstream(const basic_path<T>& filename, std::ios_base::open
 	return std::wifstream(filename.to_portable_string().c_str(), mode);
 }
 
+#ifdef _MSC_VER
 template <class T>
 std::wifstream open_wifstream(const basic_path<T>& filename, std::ios_base::openmode mode, int protection)
 {
 	return std::wifstream(filename.to_portable_string().c_str(), mode, protection);
 }
+#endif //#ifdef _MSC_VER
 
 template <class T>
 std::ofstream open_ofstream(const basic_path<T>& filename, std::ios_base::openmode mode = std::ios_base::out)
@@ -2341,11 +9387,13 @@ std::ofstream open_ofstream(const basic_path<T>& filename, std::ios_base::openmo
 	return std::ofstream(filename.to_portable_string().c_str(), mode);
 }
 
+#ifdef _MSC_VER
 template <class T>
 std::ofstream open_ofstream(const basic_path<T>& filename, std::ios_base::openmode mode, int protection)
 {
 	return std::ofstream(filename.to_portable_string().c_str(), mode, protection);
 }
+#endif //#ifdef _MSC_VER
 
 template <class T>
 std::wofstream open_wofstream(const basic_path<T>& filename, std::ios_base::openmode mode = std::ios_base::out)
@@ -2353,11 +9401,13 @@ std::wofstream open_wofstream(const basic_path<T>& filename, std::ios_base::open
 	return std::wofstream(filename.to_portable_string().c_str(), mode);
 }
 
+#ifdef _MSC_VER
 template <class T>
 std::wofstream open_wofstream(const basic_path<T>& filename, std::ios_base::openmode mode, int protection)
 {
 	return std::wofstream(filename.to_portable_string().c_str(), mode, protection);
 }
+#endif //#ifdef _MSC_VER
 
 #ifdef FS_WINDOWS_
 
@@ -2403,6 +9453,23 @@ void create_junction_point(const basic_path<T>& link, const basic_path<T>& sourc
 typedef basic_path<char>	path;
 typedef basic_path<wchar_t>	wpath;
 
+typedef basic_directory_range<char>		directory_range;
+typedef basic_directory_range<wchar_t>	wdirectory_range;
+
 } //namespace filesystem
 
+#ifdef FS_CPP11_
+namespace std
+{
+template<class T>
+struct hash< ::filesystem::basic_path<T> >
+{
+	size_t operator()(const ::filesystem::basic_path<T>& path) const
+	{
+		return path.hash();
+	}
+};
+} //namespace std
+#endif //#ifdef FS_CPP11_
+
 #endif //#ifndef _FILESYSTEM_H__